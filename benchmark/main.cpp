@@ -0,0 +1,230 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+
+#include <mysdl2/mysdl2.h>
+#include <mysdl2/loop.h>
+
+/*
+  Link:
+    SDL2, SDL2_image, SDL2_ttf, mysdl2
+
+  Usage:
+    benchmark [--reps N] [--warmup N] [--filter name] [--csv file] [--tag label] [--font file.ttf]
+
+  Times the mysdl2 pixel paths on memory surfaces, no window. Every case runs
+  'warmup' untimed batches, then 'reps' timed batches sized to take at least
+  MinBatchMs each. The CSV has one row per case so runs from two commits can
+  be diffed (or joined on name,bpp,w,h) directly.
+*/
+
+using namespace sdl2;
+
+#define MinBatchMs 2.0
+
+struct Size {
+  int w, h;
+};
+
+const Size sizes[] = { { 64, 64 }, { 640, 480 }, { 1920, 1080 } };
+const int depths[] = { 24, 32 };
+
+int reps = 30;
+int warmup = 5;
+std::string filter;
+std::string tag = "-";
+FILE *csv = nullptr;
+Font *font = nullptr;
+
+double freq = 0.0;
+
+double toMs(Uint64 ticks) {
+  return double(ticks) * 1e3 / freq;
+}
+
+// 'op' is one call, 'pixels' what a call touches
+void bench(const char *name, int w, int h, int bpp, double pixels, std::function<void()> op) {
+  if (!filter.empty() && !strstr(name, filter.c_str()))
+    return;
+
+  // batch size: enough calls to lift a batch well above timer noise
+  int batch = 1;
+  while (true) {
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    for (int i = 0; i < batch; i++)
+      op();
+    if (toMs(SDL_GetPerformanceCounter() - t0) >= MinBatchMs || batch >= (1 << 24))
+      break;
+    batch *= 2;
+  }
+
+  for (int r = 0; r < warmup; r++)
+    for (int i = 0; i < batch; i++)
+      op();
+
+  TimingStats stats;
+  for (int r = 0; r < reps; r++) {
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    for (int i = 0; i < batch; i++)
+      op();
+    stats.record(toMs(SDL_GetPerformanceCounter() - t0) / batch);
+  }
+
+  double median = stats.percentile(50.0);
+  double nsPerPixel = median * 1e6 / pixels;
+  double mpixPerSec = pixels / (median * 1e3);
+  double cv = stats.meanMs > 0.0 ? stats.stddev() / stats.meanMs * 100.0 : 0.0;
+  printf("%-12s %2d bpp %4d x %-4d  %10.4f ms  %8.3f ns/px  %9.1f Mpx/s  cv %5.1f%%\n", name, bpp, w, h, median,
+         nsPerPixel, mpixPerSec, cv);
+  if (csv)
+    fprintf(csv, "%s,%s,%d,%d,%d,%d,%d,%.6f,%.6f,%.6f,%.6f,%.6f,%.4f,%.3f\n", tag.c_str(), name, bpp, w, h, reps, batch,
+            median, stats.meanMs, stats.stddev(), stats.minMs, stats.maxMs, nsPerPixel, mpixPerSec);
+}
+
+void pixelCases(int w, int h, int bpp) {
+  Bitmap src(w, h, bpp, "src"), dst(w, h, bpp, "dst");
+  if (!src.surf || !dst.surf) {
+    printf("%d x %d x %d: could not create surfaces: %s\n", w, h, bpp, SDL_GetError());
+    return;
+  }
+  src.lock();
+  dst.lock();
+  Pixels &pixels = dst.pixels;
+  double area = double(w) * h;
+
+  bench("plot24", w, h, bpp, area, [&]() {
+    for (int y = 0; y < h; y++)
+      for (int x = 0; x < w; x++)
+        pixels.plot(x, y, Pixel24(Uint8(x), Uint8(y), 0));
+  });
+  bench("plot32", w, h, bpp, area, [&]() {
+    for (int y = 0; y < h; y++)
+      for (int x = 0; x < w; x++)
+        pixels.plot(x, y, Pixel32(Uint8(x), Uint8(y), 0, 255));
+  });
+  bench("clear24", w, h, bpp, area, [&]() {
+    pixels.clear(Pixel24(10, 20, 30));
+  });
+  bench("clear32", w, h, bpp, area, [&]() {
+    pixels.clear(Pixel32(10, 20, 30, 255));
+  });
+  src.pixels.clear(Pixel32(200, 100, 50, 255));
+  bench("sample", w, h, bpp, area, [&]() {
+    float du = 1.0f / w, dv = 1.0f / h;
+    Uint32 sum = 0;
+    for (int y = 0; y < h; y++)
+      for (int x = 0; x < w; x++)
+        sum += src.pixels.sample((x + 0.3f) * du, (y + 0.7f) * dv).g;
+    pixels.data[0] = Uint8(sum);  // keeps the loop alive
+  });
+  bench("flip", w, h, bpp, area, [&]() {
+    pixels.flip();
+  });
+  if (font) {
+    const char *text = "The quick brown fox jumps over the lazy dog 0123456789";
+    double covered = 0.0;
+    for (const char *c = text; *c; c++)
+      if (auto glyph = font->glyphs[*c - ' '])
+        covered += double(glyph->w) * glyph->h;
+    int lines = std::max(h / 20, 1);
+    bench("font", w, h, bpp, covered * lines, [&]() {
+      for (int i = 0; i < lines; i++)
+        font->render(pixels, 0, i * 20, text, Pixel24(255, 255, 255));
+    });
+  }
+
+  src.unlock();
+  dst.unlock();
+  bench("blit", w, h, bpp, area, [&]() {
+    src.blit(dst);
+  });
+}
+
+void screenCases(int w, int h, int bpp) {
+  SDL sdl;
+  if (!sdl.initOffscreen(w, h, bpp))
+    return;
+  bench("lockswap", w, h, bpp, double(w) * h, [&]() {
+    sdl.lock();
+    sdl.swap();
+  });
+  bench("frame", w, h, bpp, double(w) * h, [&]() {
+    Pixels pixels = sdl.lock();
+    pixels.clear(Pixel32(0, 0, 0, 255));
+    sdl.swap();
+  });
+  sdl.term();
+}
+
+int main(int argc, char *args[]) {
+  setbuf( stdout, NULL);
+  std::string fontPath;
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg(args[i]);
+    bool more = i + 1 < argc;
+    if (arg == "--reps" && more)
+      reps = std::max(atoi(args[++i]), 2);
+    else if (arg == "--warmup" && more)
+      warmup = std::max(atoi(args[++i]), 0);
+    else if (arg == "--filter" && more)
+      filter = args[++i];
+    else if (arg == "--tag" && more)
+      tag = args[++i];
+    else if (arg == "--font" && more)
+      fontPath = args[++i];
+    else if (arg == "--csv" && more) {
+      csv = fopen(args[++i], "w");
+      if (!csv) {
+        printf("could not open '%s'\n", args[i]);
+        return 1;
+      }
+    } else {
+      printf("usage: %s [--reps N] [--warmup N] [--filter name] [--csv file] [--tag label] [--font file.ttf]\n", args[0]);
+      return 1;
+    }
+  }
+
+  if (SDL_Init(0) < 0) {
+    printf("could not initialize SDL: %s\n", SDL_GetError());
+    return 1;
+  }
+  freq = double(SDL_GetPerformanceFrequency());
+  if (!fontPath.empty()) {
+    if (TTF_Init() < 0)
+      printf("could not initialize SDL_ttf: %s\n", TTF_GetError());
+    else {
+      font = new Font(fontPath, 16);
+      if (!font->font) {
+        printf("could not open font '%s', skipping font cases\n", fontPath.c_str());
+        delete font;
+        font = nullptr;
+      }
+    }
+  }
+
+  if (csv)
+    fprintf(csv, "tag,case,bpp,w,h,reps,batch,median_ms,mean_ms,sd_ms,min_ms,max_ms,ns_per_px,mpx_per_s\n");
+  printf("%d reps, %d warmup batches of >= %.1f ms\n\n", reps, warmup, MinBatchMs);
+
+  for (auto &size : sizes)
+    for (int bpp : depths)
+      pixelCases(size.w, size.h, bpp);
+  // SDL::term() quits SDL, so the screen cases go last
+  for (auto &size : sizes)
+    for (int bpp : depths)
+      screenCases(size.w, size.h, bpp);
+
+  if (font) {
+    delete font;
+    TTF_Quit();
+  }
+  if (csv)
+    fclose(csv);
+  SDL_Quit();
+  return 0;
+}
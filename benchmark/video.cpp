@@ -0,0 +1,483 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <mysdl2/mysdl2.h>
+#include <mysdl2/loop.h>
+#include <mysdl2/exchange.h>
+#include <mysdl2/player.h>
+#include <mysdl2/batch.h>
+#include <mysdl2/gopcache.h>
+
+/*
+  Link:
+    SDL2, SDL2_image, SDL2_ttf, mysdl2, avformat, avcodec, avutil, swscale
+
+  Usage:
+    video [--frames N] [--threads N] [--dir path] [--filter name] [--csv file] [--tag label] [--keep] [--check]
+
+  Decode pipeline benchmark, no window and no network. First encodes short
+  synthetic clips (a scrolling gradient with a block of noise, so the encoder
+  has something to chew on) with whichever of the mpeg4 and h264 encoders the
+  FFmpeg build has, at three sizes and two GOP lengths. Then every clip goes
+  through each stage on its own:
+
+    demux    av_read_frame(), per packet
+    decode   send/receive of the packets already in memory, per packet
+    scale    sws_scale() of each decoded frame to 640x480 BGRA
+    play     Player::play(), the wait on the demux and decode threads
+             running behind it
+    handoff  a FrameExchange publish/acquire of the scaled frame
+
+  and gets fps plus p50/p95/p99/max latency per stage. 'pipeline' is the
+  whole Player path (play, scale, publish) by wall clock. Clips are written
+  to 'dir' and removed afterwards unless --keep is given.
+
+  --check also compares the frames the GOP-parallel BatchDecoder delivers,
+  and the frames GopCache steps through forwards and backwards, with one
+  straight decode of the clip (the clips reorder, so any frame lost at a
+  segment or GOP cut shows) and exits with 1 on a mismatch.
+*/
+
+using namespace sdl2;
+
+#define OUT_W 640
+#define OUT_H 480
+#define CLIP_FPS 25
+
+struct Clip {
+  AVCodecID codec;
+  int w, h, gop;
+  std::string name, path;
+};
+
+const AVCodecID codecs[] = { AV_CODEC_ID_MPEG4, AV_CODEC_ID_H264 };
+const int sizes[][2] = { { 640, 360 }, { 1280, 720 }, { 1920, 1080 } };
+const int gops[] = { 12, 250 };
+
+int numFrames = 240;
+int threads = 0;
+std::string dir = ".";
+std::string filter;
+std::string tag = "-";
+FILE *csv = nullptr;
+bool keep = false;
+bool checks = false;
+int failures = 0;
+
+double freq = 0.0;
+
+double toMs(Uint64 ticks) {
+  return double(ticks) * 1e3 / freq;
+}
+
+void report(const Clip &clip, const char *stage, const TimingStats &stats, int frames, double totalMs) {
+  double fps = totalMs > 0.0 ? frames * 1e3 / totalMs : 0.0;
+  printf("%-22s %-8s %9.1f fps  p50 %8.3f  p95 %8.3f  p99 %8.3f  max %8.3f ms\n", clip.name.c_str(), stage, fps,
+         stats.percentile(50.0), stats.percentile(95.0), stats.percentile(99.0), stats.maxMs);
+  if (csv)
+    fprintf(csv, "%s,%s,%d,%d,%d,%d,%s,%d,%.2f,%.6f,%.6f,%.6f,%.6f\n", tag.c_str(), avcodec_get_name(clip.codec), clip.w,
+            clip.h, clip.gop, threads, stage, frames, fps, stats.percentile(50.0), stats.percentile(95.0),
+            stats.percentile(99.0), stats.maxMs);
+}
+
+// moving test pattern: diagonal ramps in all three planes and a scrolling
+// block of noise, which keeps both the motion search and the residuals busy
+void fillFrame(AVFrame *frame, int i) {
+  int w = frame->width, h = frame->height;
+  for (int y = 0; y < h; y++) {
+    uint8_t *row = frame->data[0] + y * frame->linesize[0];
+    for (int x = 0; x < w; x++)
+      row[x] = uint8_t(x + y + i * 3);
+  }
+  for (int y = 0; y < h / 2; y++) {
+    uint8_t *u = frame->data[1] + y * frame->linesize[1];
+    uint8_t *v = frame->data[2] + y * frame->linesize[2];
+    for (int x = 0; x < w / 2; x++) {
+      u[x] = uint8_t(128 + y + i * 2);
+      v[x] = uint8_t(64 + x + i * 5);
+    }
+  }
+  uint32_t seed = uint32_t(i) * 2654435761u + 1;
+  int bw = w / 4, bh = h / 4;
+  int bx = (i * 8) % (w - bw), by = h / 3;
+  for (int y = by; y < by + bh; y++) {
+    uint8_t *row = frame->data[0] + y * frame->linesize[0];
+    for (int x = bx; x < bx + bw; x++) {
+      seed = seed * 1664525u + 1013904223u;
+      row[x] = uint8_t(seed >> 24);
+    }
+  }
+}
+
+bool encode(Clip &clip) {
+  const AVCodec *codec = avcodec_find_encoder(clip.codec);
+  AVFormatContext *out = nullptr;
+  if (avformat_alloc_output_context2(&out, nullptr, nullptr, clip.path.c_str()) < 0 || !out) {
+    printf("%s: no muxer for '%s'\n", clip.name.c_str(), clip.path.c_str());
+    return false;
+  }
+  AVStream *stream = avformat_new_stream(out, nullptr);
+  AVCodecContext *enc = avcodec_alloc_context3(codec);
+  enc->width = clip.w;
+  enc->height = clip.h;
+  enc->pix_fmt = AV_PIX_FMT_YUV420P;
+  enc->time_base = av_make_q(1, CLIP_FPS);
+  enc->framerate = av_make_q(CLIP_FPS, 1);
+  enc->gop_size = clip.gop;
+  enc->max_b_frames = 2;  // reordering, like most real recordings
+  enc->bit_rate = int64_t(clip.w) * clip.h * 3;
+  if (out->oformat->flags & AVFMT_GLOBALHEADER)
+    enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  av_opt_set(enc->priv_data, "preset", "veryfast", 0);  // x264 only, ignored elsewhere
+
+  AVFrame *frame = av_frame_alloc();
+  AVPacket *packet = av_packet_alloc();
+  bool ok = avcodec_open2(enc, codec, nullptr) >= 0 && avcodec_parameters_from_context(stream->codecpar, enc) >= 0;
+  if (ok) {
+    stream->time_base = enc->time_base;
+    ok = avio_open(&out->pb, clip.path.c_str(), AVIO_FLAG_WRITE) >= 0 && avformat_write_header(out, nullptr) >= 0;
+  }
+  if (ok) {
+    frame->format = enc->pix_fmt;
+    frame->width = clip.w;
+    frame->height = clip.h;
+    ok = av_frame_get_buffer(frame, 0) >= 0;
+  }
+
+  auto drain = [&]() {
+    while (avcodec_receive_packet(enc, packet) >= 0) {
+      av_packet_rescale_ts(packet, enc->time_base, stream->time_base);
+      packet->stream_index = stream->index;
+      av_interleaved_write_frame(out, packet);
+    }
+  };
+  for (int i = 0; ok && i < numFrames; i++) {
+    av_frame_make_writable(frame);
+    fillFrame(frame, i);
+    frame->pts = i;
+    if (avcodec_send_frame(enc, frame) < 0)
+      ok = false;
+    drain();
+  }
+  if (ok) {
+    avcodec_send_frame(enc, nullptr);
+    drain();
+    ok = av_write_trailer(out) >= 0;
+  }
+  if (!ok)
+    printf("%s: encoding failed\n", clip.name.c_str());
+
+  av_packet_free(&packet);
+  av_frame_free(&frame);
+  avcodec_free_context(&enc);
+  if (out->pb)
+    avio_closep(&out->pb);
+  avformat_free_context(out);
+  return ok;
+}
+
+// demux, decode and scale, each timed on its own: all packets are read
+// first, so decoding never waits on I/O
+void stages(const Clip &clip) {
+  AVFormatContext *fmtCtx = nullptr;
+  if (avformat_open_input(&fmtCtx, clip.path.c_str(), nullptr, nullptr) != 0) {
+    printf("%s: could not open '%s'\n", clip.name.c_str(), clip.path.c_str());
+    return;
+  }
+  avformat_find_stream_info(fmtCtx, nullptr);
+  int vidStream = av_find_best_stream(fmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+  if (vidStream < 0) {
+    avformat_close_input(&fmtCtx);
+    return;
+  }
+
+  TimingStats demuxTime;
+  std::vector<AVPacket*> packets;
+  Uint64 t0 = SDL_GetPerformanceCounter();
+  while (true) {
+    AVPacket *packet = av_packet_alloc();
+    Uint64 t = SDL_GetPerformanceCounter();
+    int resp = av_read_frame(fmtCtx, packet);
+    demuxTime.record(toMs(SDL_GetPerformanceCounter() - t));
+    if (resp < 0) {
+      av_packet_free(&packet);
+      break;
+    }
+    if (packet->stream_index == vidStream)
+      packets.push_back(packet);
+    else
+      av_packet_free(&packet);
+  }
+  report(clip, "demux", demuxTime, int(packets.size()), toMs(SDL_GetPerformanceCounter() - t0));
+
+  AVCodecParameters *par = fmtCtx->streams[vidStream]->codecpar;
+  const AVCodec *codec = avcodec_find_decoder(par->codec_id);
+  AVCodecContext *codecCtx = avcodec_alloc_context3(codec);
+  avcodec_parameters_to_context(codecCtx, par);
+  codecCtx->thread_count = threads;
+  codecCtx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  if (!codec || avcodec_open2(codecCtx, codec, nullptr) < 0) {
+    printf("%s: no decoder\n", clip.name.c_str());
+    avcodec_free_context(&codecCtx);
+    for (auto packet : packets)
+      av_packet_free(&packet);
+    avformat_close_input(&fmtCtx);
+    return;
+  }
+
+  std::vector<uint8_t> buffer(size_t(OUT_W) * OUT_H * 4);
+  uint8_t *dst[4] = { buffer.data() };
+  int dstStride[4] = { OUT_W * 4 };
+  SwsContext *swsCtx = nullptr;
+  AVFrame *frame = av_frame_alloc();
+  TimingStats decodeTime, scaleTime;
+  double decodeMs = 0.0, scaleMs = 0.0;
+  int frames = 0;
+
+  auto receive = [&](Uint64 begin) {
+    while (avcodec_receive_frame(codecCtx, frame) >= 0) {
+      frames++;
+      Uint64 t = SDL_GetPerformanceCounter();
+      swsCtx = sws_getCachedContext(swsCtx, frame->width, frame->height, AVPixelFormat(frame->format), OUT_W, OUT_H,
+                                    AV_PIX_FMT_BGRA, SWS_BILINEAR, nullptr, nullptr, nullptr);
+      sws_scale(swsCtx, frame->data, frame->linesize, 0, frame->height, dst, dstStride);
+      double ms = toMs(SDL_GetPerformanceCounter() - t);
+      scaleTime.record(ms);
+      scaleMs += ms;
+      begin += SDL_GetPerformanceCounter() - t;  // scaling isn't decode time
+      av_frame_unref(frame);
+    }
+    return begin;
+  };
+  for (size_t i = 0; i <= packets.size(); i++) {
+    Uint64 begin = SDL_GetPerformanceCounter();
+    avcodec_send_packet(codecCtx, i < packets.size() ? packets[i] : nullptr);  // the last round drains
+    begin = receive(begin);
+    double ms = toMs(SDL_GetPerformanceCounter() - begin);
+    decodeTime.record(ms);
+    decodeMs += ms;
+  }
+  report(clip, "decode", decodeTime, frames, decodeMs);
+  report(clip, "scale", scaleTime, frames, scaleMs);
+
+  sws_freeContext(swsCtx);
+  av_frame_free(&frame);
+  avcodec_free_context(&codecCtx);
+  for (auto packet : packets)
+    av_packet_free(&packet);
+  avformat_close_input(&fmtCtx);
+}
+
+// pts of every frame in output order, one decoder from start to end
+std::vector<int64_t> straightPts(const Clip &clip) {
+  std::vector<int64_t> pts;
+  AVFormatContext *fmtCtx = nullptr;
+  if (avformat_open_input(&fmtCtx, clip.path.c_str(), nullptr, nullptr) != 0)
+    return pts;
+  avformat_find_stream_info(fmtCtx, nullptr);
+  int vidStream = av_find_best_stream(fmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+  const AVCodec *codec = vidStream >= 0 ? avcodec_find_decoder(fmtCtx->streams[vidStream]->codecpar->codec_id) : nullptr;
+  AVCodecContext *codecCtx = avcodec_alloc_context3(codec);
+  if (codec)
+    avcodec_parameters_to_context(codecCtx, fmtCtx->streams[vidStream]->codecpar);
+  if (codec && avcodec_open2(codecCtx, codec, nullptr) >= 0) {
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    auto receive = [&]() {
+      while (avcodec_receive_frame(codecCtx, frame) >= 0) {
+        pts.push_back(frame->best_effort_timestamp);
+        av_frame_unref(frame);
+      }
+    };
+    while (av_read_frame(fmtCtx, packet) >= 0) {
+      if (packet->stream_index == vidStream) {
+        avcodec_send_packet(codecCtx, packet);
+        receive();
+      }
+      av_packet_unref(packet);
+    }
+    avcodec_send_packet(codecCtx, nullptr);
+    receive();
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+  }
+  avcodec_free_context(&codecCtx);
+  avformat_close_input(&fmtCtx);
+  return pts;
+}
+
+void check(const char *name, const Clip &clip, const std::vector<int64_t> &expected, const std::vector<int64_t> &got) {
+  bool ok = !expected.empty() && got == expected;
+  printf("%-22s check    %-8s %zu of %zu frames %s\n", clip.name.c_str(), name, got.size(), expected.size(),
+         ok ? "ok" : "MISMATCH");
+  if (!ok)
+    failures++;
+}
+
+// BatchDecoder against a straight decode, segment cuts must not lose frames
+void checkBatch(const Clip &clip, const std::vector<int64_t> &expected) {
+  BatchDecoder decoder(clip.path, 4);
+  std::vector<int64_t> got;
+  decoder.run([&got](const AVFrame *f) {
+    got.push_back(f->best_effort_timestamp);
+  });
+  check("batch", clip, expected, got);
+}
+
+// GopCache stepped across every GOP boundary, forwards then backwards
+void checkSteps(const Clip &clip, const std::vector<int64_t> &expected) {
+  KeyframeIndex index;
+  AVFormatContext *fmtCtx = nullptr;
+  if (avformat_open_input(&fmtCtx, clip.path.c_str(), nullptr, nullptr) == 0) {
+    avformat_find_stream_info(fmtCtx, nullptr);
+    int vidStream = av_find_best_stream(fmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (vidStream >= 0 && !index.fromStream(fmtCtx, vidStream))
+      index.scan(fmtCtx, vidStream);
+    avformat_close_input(&fmtCtx);
+  }
+  std::vector<int64_t> forward, backward;
+  GopCache cache(clip.path, size_t(64) << 20, 4);
+  if (!index.empty() && !expected.empty() && cache.open()) {
+    cache.setKeyframes(index.pts, index.reorders);
+    AVFrame *f = cache.step(expected.front(), 0);
+    while (f) {
+      forward.push_back(f->pts);
+      AVFrame *next = cache.step(f->pts, 1);
+      av_frame_free(&f);
+      f = next;
+    }
+    f = cache.step(expected.back(), 0);
+    while (f) {
+      backward.push_back(f->pts);
+      AVFrame *next = cache.step(f->pts, -1);
+      av_frame_free(&f);
+      f = next;
+    }
+    std::reverse(backward.begin(), backward.end());
+  }
+  check("step +1", clip, expected, forward);
+  check("step -1", clip, expected, backward);
+}
+
+// the threaded Player path as the demos use it, minus the window
+void pipeline(const Clip &clip) {
+  FrameExchange exchange;
+  if (!exchange.init(OUT_W, OUT_H, 32))
+    return;
+  Player player(clip.path, OUT_W, OUT_H, AV_PIX_FMT_RGB24, threads ? Player::FrameThreads : Player::AutoThreads,
+                threads);
+  if (!player.codecCtx)
+    return;
+  player.adaptive = false;  // full quality, comparable with the decode stage
+
+  TimingStats playTime, handoffTime, frameTime;
+  int frames = 0;
+  double playMs = 0.0, handoffMs = 0.0;
+  Uint64 t0 = SDL_GetPerformanceCounter();
+  while (true) {
+    Uint64 t = SDL_GetPerformanceCounter();
+    if (!player.play())
+      break;
+    double ms = toMs(SDL_GetPerformanceCounter() - t);
+    playTime.record(ms);
+    playMs += ms;
+    player.decode(exchange.back());
+    Uint64 t2 = SDL_GetPerformanceCounter();
+    exchange.publish();
+    exchange.acquire();
+    ms = toMs(SDL_GetPerformanceCounter() - t2);
+    handoffTime.record(ms);
+    handoffMs += ms;
+    frameTime.record(toMs(SDL_GetPerformanceCounter() - t));
+    frames++;
+  }
+  double totalMs = toMs(SDL_GetPerformanceCounter() - t0);
+  report(clip, "play", playTime, frames, playMs);
+  report(clip, "handoff", handoffTime, frames, handoffMs);
+  report(clip, "pipeline", frameTime, frames, totalMs);
+}
+
+int main(int argc, char *args[]) {
+  setbuf( stdout, NULL);
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg(args[i]);
+    bool more = i + 1 < argc;
+    if (arg == "--frames" && more)
+      numFrames = std::max(atoi(args[++i]), 1);
+    else if (arg == "--threads" && more)
+      threads = std::max(atoi(args[++i]), 0);
+    else if (arg == "--dir" && more)
+      dir = args[++i];
+    else if (arg == "--filter" && more)
+      filter = args[++i];
+    else if (arg == "--tag" && more)
+      tag = args[++i];
+    else if (arg == "--keep")
+      keep = true;
+    else if (arg == "--check")
+      checks = true;
+    else if (arg == "--csv" && more) {
+      csv = fopen(args[++i], "w");
+      if (!csv) {
+        printf("could not open '%s'\n", args[i]);
+        return 1;
+      }
+    } else {
+      printf("usage: %s [--frames N] [--threads N] [--dir path] [--filter name] [--csv file] [--tag label] [--keep] "
+             "[--check]\n", args[0]);
+      return 1;
+    }
+  }
+
+  if (SDL_Init(0) < 0) {
+    printf("could not initialize SDL: %s\n", SDL_GetError());
+    return 1;
+  }
+  freq = double(SDL_GetPerformanceFrequency());
+  av_log_set_level(AV_LOG_ERROR);
+
+  if (csv)
+    fprintf(csv, "tag,codec,w,h,gop,threads,stage,frames,fps,p50_ms,p95_ms,p99_ms,max_ms\n");
+  printf("%d frames per clip, %d decoder threads (0 = auto), output %d x %d\n\n", numFrames, threads, OUT_W, OUT_H);
+
+  for (AVCodecID id : codecs) {
+    const AVCodec *codec = avcodec_find_encoder(id);
+    if (!codec) {
+      printf("no %s encoder in this build, skipping\n", avcodec_get_name(id));
+      continue;
+    }
+    for (auto &size : sizes)
+      for (int gop : gops) {
+        Clip clip { id, size[0], size[1], gop };
+        clip.name = std::string(codec->name) + "-" + std::to_string(clip.h) + "p-g" + std::to_string(gop);
+        clip.path = dir + "/bench-" + clip.name + ".mp4";
+        if (!filter.empty() && clip.name.find(filter) == std::string::npos)
+          continue;
+        if (!encode(clip))
+          continue;
+        stages(clip);
+        pipeline(clip);
+        if (checks) {
+          auto expected = straightPts(clip);
+          checkBatch(clip, expected);
+          checkSteps(clip, expected);
+        }
+        printf("\n");
+        if (!keep)
+          remove(clip.path.c_str());
+      }
+  }
+
+  if (csv)
+    fclose(csv);
+  SDL_Quit();
+  if (checks)
+    printf("%d check(s) failed\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,88 @@
+#include "assets.h"
+
+using namespace sdl2;
+
+// SDL_ttf shares one FreeType library between all fonts, so font decodes
+// are serialised whichever thread they happen on
+static std::mutex ttfMutex;
+
+Assets::Assets(bool background) {
+  if (background)
+    loader = std::thread(&Assets::work, this);
+}
+
+Assets::~Assets() {
+  {
+    std::lock_guard<std::mutex> lg(mutex);
+    quit = true;
+  }
+  wake.notify_all();
+  if (loader.joinable())
+    loader.join();
+}
+
+void Assets::work() {
+  std::unique_lock<std::mutex> lk(mutex);
+  while (true) {
+    wake.wait(lk, [this]() {
+      return quit || !jobs.empty();
+    });
+    if (quit)
+      break;
+    Job job = jobs.top();
+    jobs.pop();
+    busy++;
+    lk.unlock();
+    job.run();
+    job.run = nullptr;  // release the entry outside the lock
+    lk.lock();
+    busy--;
+    if (jobs.empty() && !busy)
+      done.notify_all();
+  }
+}
+
+void Assets::wait() {
+  std::unique_lock<std::mutex> lk(mutex);
+  done.wait(lk, [this]() {
+    return quit || !loader.joinable() || (jobs.empty() && !busy);
+  });
+}
+
+void Assets::purge() {
+  std::lock_guard<std::mutex> lg(mutex);
+  preloaded.clear();
+  for (auto it = cache.begin(); it != cache.end();) {
+    if (it->second.expired())
+      it = cache.erase(it);
+    else
+      ++it;
+  }
+}
+
+size_t Assets::size() {
+  std::lock_guard<std::mutex> lg(mutex);
+  return cache.size();
+}
+
+AssetHandle<Bitmap> Assets::bitmap(std::string_view path, Priority priority) {
+  std::string file(path);
+  return acquire<Bitmap>("bmp:" + file, [file]() {
+    return std::make_unique<Bitmap>(file.c_str());
+  }, priority);
+}
+
+AssetHandle<MappedBitmap> Assets::mapped(std::string_view path, Priority priority) {
+  std::string file(path);
+  return acquire<MappedBitmap>("map:" + file, [file]() {
+    return std::make_unique<MappedBitmap>(file.c_str());
+  }, priority);
+}
+
+AssetHandle<Font> Assets::font(std::string_view path, int size, Priority priority) {
+  std::string file(path);
+  return acquire<Font>("ttf:" + file + ":" + std::to_string(size), [file, size]() {
+    std::lock_guard<std::mutex> lg(ttfMutex);
+    return std::make_unique<Font>(file, size);
+  }, priority);
+}
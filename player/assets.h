@@ -0,0 +1,129 @@
+#pragma once
+
+#include "mysdl2.h"
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+
+namespace sdl2 {
+
+template<class T>
+struct AssetEntry {
+  std::string key;
+  std::once_flag once;
+  std::atomic<bool> loaded { false };
+  std::unique_ptr<T> asset;
+  std::function<std::unique_ptr<T>()> load;
+
+  void decode() {
+    std::call_once(once, [this]() {
+      asset = load();
+      load = nullptr;
+      loaded = true;
+    });
+  }
+};
+
+// ref-counted view of a cached asset, decoded on first get() unless the
+// background loader got to it first
+template<class T>
+struct AssetHandle {
+  std::shared_ptr<AssetEntry<T>> entry;
+
+  T* get() {
+    if (!entry)
+      return nullptr;
+    entry->decode();
+    return entry->asset.get();
+  }
+  T* operator ->() {
+    return get();
+  }
+  bool ready() const {
+    return entry && entry->loaded;
+  }
+  explicit operator bool() const {
+    return entry != nullptr;
+  }
+};
+
+// Deduplicates assets by path (and size for fonts). The cache only keeps weak
+// references, an asset lives as long as some handle refers to it. A preload
+// (any priority but Lazy) is also held by the cache itself until the asset
+// is next acquired or purge() runs, so it survives a dropped handle.
+struct Assets {
+  enum Priority {
+    Lazy = -1,
+    Low = 0,
+    Normal = 1,
+    High = 2
+  };
+
+  struct Job {
+    int priority = 0;
+    Uint64 seq = 0;
+    std::function<void()> run;
+    bool operator <(const Job &rhs) const {
+      return priority != rhs.priority ? priority < rhs.priority : seq > rhs.seq;
+    }
+  };
+
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  std::unordered_map<std::string, std::weak_ptr<void>> cache;
+  std::unordered_map<std::string, std::shared_ptr<void>> preloaded;
+  std::priority_queue<Job> jobs;
+  Uint64 seq = 0;
+  int busy = 0;
+  bool quit = false;
+  std::thread loader;
+
+  Assets(bool background = true);
+  Assets(const Assets&) = delete;
+  Assets& operator =(const Assets&) = delete;
+  ~Assets();
+
+  AssetHandle<Bitmap> bitmap(std::string_view path, Priority priority = Lazy);
+  AssetHandle<MappedBitmap> mapped(std::string_view path, Priority priority = Lazy);
+  AssetHandle<Font> font(std::string_view path, int size, Priority priority = Lazy);
+
+  void wait();  // blocks until every queued preload has been decoded
+  void purge();  // drops preload refs, then cache slots whose assets are gone
+  size_t size();
+
+  template<class T>
+  AssetHandle<T> acquire(std::string key, std::function<std::unique_ptr<T>()> load, Priority priority) {
+    AssetHandle<T> handle;
+    std::lock_guard<std::mutex> lg(mutex);
+    auto &slot = cache[key];
+    handle.entry = std::static_pointer_cast<AssetEntry<T>>(slot.lock());
+    if (!handle.entry) {
+      handle.entry = std::make_shared<AssetEntry<T>>();
+      handle.entry->key = key;
+      handle.entry->load = std::move(load);
+      slot = handle.entry;
+    } else
+      preloaded.erase(key);  // the caller holds it from here on
+    if (priority != Lazy && !handle.entry->loaded && loader.joinable()) {
+      auto entry = handle.entry;
+      preloaded[key] = entry;
+      jobs.push(Job { int(priority), seq++, [entry]() {
+        entry->decode();
+      } });
+      wake.notify_one();
+    }
+    return handle;
+  }
+
+  void work();
+};
+
+}
@@ -0,0 +1,314 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
+}
+
+#include "keyindex.h"
+
+// Whole-file decoding for offline jobs, split at keyframes. scan() finds the
+// video keyframes and cuts the stream into runs of whole GOPs, run() decodes
+// the runs concurrently, each worker with its own demuxer and single-threaded
+// codec, so throughput scales past what the codec's own threading reaches.
+//
+// Every run seeks to its first keyframe and keeps only frames with a pts in
+// [start, end). When the stream reorders frames it also feeds the next
+// keyframe and its leading pictures, so open GOPs still decode right at the
+// cut.
+struct BatchDecoder {
+  struct Segment {
+    int64_t start = 0, end = INT64_MAX;  // pts, stream time base
+    std::deque<AVFrame*> frames;  // decoded, waiting for an ordered run()
+    bool done = false;
+  };
+
+  static constexpr size_t MaxSegmentGops = 4;
+
+  std::string url;
+  int workers = 0;
+  // ordered run(): decoded frames waiting behind the segment being delivered
+  size_t maxQueuedBytes = size_t(512) << 20;
+  int vidStream = -1;
+  AVRational timeBase { 0, 1 };
+  bool reorders = false;
+  std::vector<int64_t> keyframes;
+  std::vector<Segment> segments;
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t next = 0, cursor = 0;
+  size_t queuedBytes = 0;
+  std::atomic<uint64_t> decoded { 0 };
+
+  // 'workers' = 0 starts one per core
+  BatchDecoder(std::string_view url_, int workers_ = 0)
+      :
+      url(url_),
+      workers(workers_) {
+    if (workers <= 0)
+      workers = std::max(1, int(std::thread::hardware_concurrency()));
+  }
+
+  ~BatchDecoder() {
+    clear();
+  }
+
+  static bool open(const std::string &url, AVFormatContext **fmtCtx,
+                   AVCodecContext **codecCtx, int &stream) {
+    if (avformat_open_input(fmtCtx, url.c_str(), nullptr, nullptr) != 0) {
+      printf("BatchDecoder failed to open '%s'\n", url.c_str());
+      return false;
+    }
+    avformat_find_stream_info(*fmtCtx, nullptr);
+    stream = -1;
+    for (int i = 0; i < (int) (*fmtCtx)->nb_streams; i++)
+      if ((*fmtCtx)->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+        stream = i;
+        break;
+      }
+    if (stream < 0) {
+      avformat_close_input(fmtCtx);
+      return false;
+    }
+    if (!codecCtx)
+      return true;
+    *codecCtx = avcodec_alloc_context3(nullptr);
+    avcodec_parameters_to_context(*codecCtx,
+                                  (*fmtCtx)->streams[stream]->codecpar);
+    (*codecCtx)->thread_count = 1;  // the parallelism is across segments
+    const AVCodec *codec = avcodec_find_decoder((*codecCtx)->codec_id);
+    if (!codec || avcodec_open2(*codecCtx, codec, nullptr) < 0) {
+      avcodec_free_context(codecCtx);
+      avformat_close_input(fmtCtx);
+      return false;
+    }
+    return true;
+  }
+
+  void clear() {
+    for (auto &segment : segments)
+      for (auto f : segment.frames)
+        av_frame_free(&f);
+    segments.clear();
+  }
+
+  // Finds the keyframes, from the container's index where it has one,
+  // otherwise by reading through every packet (no decoding), and cuts them
+  // into segments of at most MaxSegmentGops GOPs, about four per worker on
+  // short files.
+  bool scan() {
+    AVFormatContext *fmtCtx = nullptr;
+    AVCodecContext *codecCtx = nullptr;
+    if (!open(url, &fmtCtx, &codecCtx, vidStream))
+      return false;
+    AVStream *stream = fmtCtx->streams[vidStream];
+    timeBase = stream->time_base;
+    reorders = codecCtx->has_b_frames > 0;
+    avcodec_free_context(&codecCtx);
+
+    KeyframeIndex index;
+    if (!index.fromStream(fmtCtx, vidStream))
+      index.scan(fmtCtx, vidStream);
+    avformat_close_input(&fmtCtx);
+    keyframes = std::move(index.pts);
+    reorders = reorders || index.reorders;
+    if (keyframes.empty())
+      return false;
+
+    clear();
+    size_t perSegment = std::clamp<size_t>(
+        keyframes.size() / (size_t(workers) * 4), 1, MaxSegmentGops);
+    for (size_t i = 0; i < keyframes.size(); i += perSegment) {
+      Segment segment;
+      segment.start = keyframes[i];
+      size_t last = i + perSegment;
+      segment.end = last < keyframes.size() ? keyframes[last] : INT64_MAX;
+      segments.push_back(std::move(segment));
+    }
+    printf("BatchDecoder: %zu keyframes in %zu segments, %d workers\n",
+           keyframes.size(), segments.size(), workers);
+    return true;
+  }
+
+  // Decodes every frame and hands it to 'fn', which must not keep the frame.
+  // Ordered, 'fn' runs on the calling thread in pts order, with workers
+  // staying at most two segments each and 'maxQueuedBytes' of frames ahead
+  // of it. Unordered, 'fn' runs on the workers as frames come out
+  // (frame->pts tells where they belong) and has to be thread safe. Returns
+  // the number of frames delivered.
+  uint64_t run(std::function<void(const AVFrame*)> fn, bool ordered = true) {
+    if (segments.empty() && !scan())
+      return 0;
+    for (auto &segment : segments) {
+      for (auto f : segment.frames)
+        av_frame_free(&f);
+      segment.frames.clear();
+      segment.done = false;
+    }
+    next = cursor = 0;
+    queuedBytes = 0;
+    decoded = 0;
+
+    size_t maxAhead = size_t(workers) * 2;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < workers; i++)
+      threads.emplace_back(&BatchDecoder::work, this, fn, ordered, maxAhead);
+
+    uint64_t delivered = 0;
+    if (ordered)
+      for (size_t i = 0; i < segments.size(); i++) {
+        Segment &segment = segments[i];
+        while (true) {
+          AVFrame *f = nullptr;
+          {
+            std::unique_lock<std::mutex> lk(mutex);
+            cv.wait(lk, [&segment]() {
+              return segment.done || !segment.frames.empty();
+            });
+            if (segment.frames.empty()) {
+              cursor = i + 1;
+              cv.notify_all();
+              break;
+            }
+            f = segment.frames.front();
+            segment.frames.pop_front();
+            queuedBytes -= frameBytes(f);
+            cv.notify_all();
+          }
+          fn(f);
+          av_frame_free(&f);
+          delivered++;
+        }
+      }
+    for (auto &thread : threads)
+      thread.join();
+    return ordered ? delivered : decoded.load();
+  }
+
+  void work(std::function<void(const AVFrame*)> fn, bool ordered,
+            size_t maxAhead) {
+    AVFormatContext *fmtCtx = nullptr;
+    AVCodecContext *codecCtx = nullptr;
+    int stream = -1;
+    bool opened = open(url, &fmtCtx, &codecCtx, stream);
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+
+    while (true) {
+      size_t i;
+      {
+        std::unique_lock<std::mutex> lk(mutex);
+        cv.wait(lk, [&]() {
+          return next >= segments.size() || !ordered
+              || next < cursor + maxAhead;
+        });
+        if (next >= segments.size())
+          break;
+        i = next++;
+      }
+      // a worker that couldn't open still marks its segments done, so an
+      // ordered run() doesn't wait on them forever
+      if (opened)
+        decodeSegment(i, fmtCtx, codecCtx, packet, frame, fn, ordered);
+      std::lock_guard<std::mutex> lg(mutex);
+      segments[i].done = true;
+      cv.notify_all();
+    }
+
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    if (codecCtx)
+      avcodec_free_context(&codecCtx);
+    if (fmtCtx)
+      avformat_close_input(&fmtCtx);
+  }
+
+  static size_t frameBytes(const AVFrame *f) {
+    return size_t(std::max(0, av_image_get_buffer_size(
+        AVPixelFormat(f->format), f->width, f->height, 1)));
+  }
+
+  void decodeSegment(size_t i, AVFormatContext *fmtCtx,
+                     AVCodecContext *codecCtx, AVPacket *packet,
+                     AVFrame *frame,
+                     const std::function<void(const AVFrame*)> &fn,
+                     bool ordered) {
+    Segment &segment = segments[i];
+    avcodec_flush_buffers(codecCtx);
+    if (av_seek_frame(fmtCtx, vidStream, segment.start, AVSEEK_FLAG_BACKWARD)
+        < 0) {
+      printf("BatchDecoder: seek to %lld failed\n",
+             (long long) segment.start);
+      return;
+    }
+
+    auto receive = [&]() {
+      while (avcodec_receive_frame(codecCtx, frame) >= 0) {
+        int64_t pts = frame->best_effort_timestamp;
+        if (pts != AV_NOPTS_VALUE
+            && (pts < segment.start || pts >= segment.end)) {
+          av_frame_unref(frame);
+          continue;
+        }
+        decoded++;
+        if (!ordered) {
+          fn(frame);
+          av_frame_unref(frame);
+          continue;
+        }
+        AVFrame *kept = av_frame_alloc();
+        av_frame_move_ref(kept, frame);
+        size_t bytes = frameBytes(kept);
+        std::unique_lock<std::mutex> lk(mutex);
+        // the segment being delivered always gets through, or nothing moves
+        cv.wait(lk, [&]() {
+          return i <= cursor || queuedBytes < maxQueuedBytes;
+        });
+        segment.frames.push_back(kept);
+        queuedBytes += bytes;
+        cv.notify_all();
+      }
+    };
+
+    bool tail = false;
+    while (av_read_frame(fmtCtx, packet) >= 0) {
+      if (packet->stream_index != vidStream) {
+        av_packet_unref(packet);
+        continue;
+      }
+      int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+      if (pts != AV_NOPTS_VALUE && pts >= segment.end) {
+        // past the cut: done, unless the next keyframe's leading pictures
+        // still need it as a reference
+        if (tail || !reorders || !(packet->flags & AV_PKT_FLAG_KEY)) {
+          av_packet_unref(packet);
+          break;
+        }
+        tail = true;
+      }
+      int resp = avcodec_send_packet(codecCtx, packet);
+      av_packet_unref(packet);
+      if (resp < 0 && resp != AVERROR(EAGAIN))
+        printf("avcodec_send_packet() error: '%s'\n", av_err2str(resp));
+      receive();
+    }
+    avcodec_send_packet(codecCtx, nullptr);
+    receive();
+  }
+};
@@ -0,0 +1,250 @@
+#include "convert.h"
+
+#include <algorithm>
+#include <x86intrin.h>
+
+using namespace sdl2;
+
+typedef void (*RowFn)(const Uint8 *src, Uint8 *dst, int w, Uint8 alpha);
+
+static inline bool isBGR(PixelLayout layout) {
+  return layout == BGR24 || layout == BGRA32;
+}
+
+static inline Uint8* rowOf(const Pixels &pixels, int y) {
+  return &pixels.data[(pixels.inverted ? pixels.h - 1 - y : y) * pixels.p];
+}
+
+// S/D are source/destination bytes per pixel, Swap exchanges bytes 0 and 2
+template<int S, int D, bool Swap>
+static void rowScalar(const Uint8 *src, Uint8 *dst, int w, Uint8 alpha) {
+  for (int x = 0; x < w; x++, src += S, dst += D) {
+    Uint8 c0 = src[0], c1 = src[1], c2 = src[2];
+    Uint8 a = S == 4 ? src[3] : alpha;
+    dst[0] = Swap ? c2 : c0;
+    dst[1] = c1;
+    dst[2] = Swap ? c0 : c2;
+    if (D == 4)
+      dst[3] = a;
+  }
+}
+
+// pshufb control for 4 pixels; unused output bytes are zeroed, except for
+// 24->24 where bytes 12..15 pass through so in-place stores stay harmless
+template<int S, int D, bool Swap>
+static __m128i shuffleMask() {
+  alignas(16) Sint8 mask[16];
+  for (int i = 0; i < 16; i++)
+    mask[i] = (S == 3 && D == 3) ? Sint8(i) : Sint8(0x80);
+  for (int i = 0; i < 4; i++)
+    for (int k = 0; k < D; k++) {
+      int from = k == 3 ? 3 : Swap ? 2 - k : k;
+      if (from < S)
+        mask[i * D + k] = Sint8(i * S + from);
+    }
+  return _mm_load_si128((const __m128i*) mask);
+}
+
+template<int S, int D, bool Swap>
+__attribute__((target("ssse3")))
+static void rowSSSE3(const Uint8 *src, Uint8 *dst, int w, Uint8 alpha) {
+  static const __m128i mask = shuffleMask<S, D, Swap>();
+  const __m128i fill = _mm_set1_epi32(int(Uint32(alpha) << 24));
+  int x = 0;
+  if (S == 3 && D == 4) {
+    for (; x + 6 <= w; x += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i*) &src[x * 3]);
+      v = _mm_or_si128(_mm_shuffle_epi8(v, mask), fill);
+      _mm_storeu_si128((__m128i*) &dst[x * 4], v);
+    }
+  } else if (S == 4 && D == 4) {
+    for (; x + 4 <= w; x += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i*) &src[x * 4]);
+      _mm_storeu_si128((__m128i*) &dst[x * 4], _mm_shuffle_epi8(v, mask));
+    }
+  } else if (S == 3 && D == 3) {
+    for (; x + 6 <= w; x += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i*) &src[x * 3]);
+      _mm_storeu_si128((__m128i*) &dst[x * 3], _mm_shuffle_epi8(v, mask));
+    }
+  } else {
+    // 16 pixels packed into three 16 byte stores
+    for (; x + 16 <= w; x += 16) {
+      const __m128i *in = (const __m128i*) &src[x * 4];
+      __m128i a = _mm_shuffle_epi8(_mm_loadu_si128(&in[0]), mask);
+      __m128i b = _mm_shuffle_epi8(_mm_loadu_si128(&in[1]), mask);
+      __m128i c = _mm_shuffle_epi8(_mm_loadu_si128(&in[2]), mask);
+      __m128i d = _mm_shuffle_epi8(_mm_loadu_si128(&in[3]), mask);
+      __m128i *out = (__m128i*) &dst[x * 3];
+      _mm_storeu_si128(&out[0], _mm_or_si128(a, _mm_slli_si128(b, 12)));
+      _mm_storeu_si128(&out[1], _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+      _mm_storeu_si128(&out[2], _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+    }
+    for (; x + 4 <= w; x += 4) {
+      __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) &src[x * 4]), mask);
+      _mm_storel_epi64((__m128i*) &dst[x * 3], v);
+      Uint32 tail = Uint32(_mm_cvtsi128_si32(_mm_srli_si128(v, 8)));
+      memcpy(&dst[x * 3 + 8], &tail, 4);
+    }
+  }
+  rowScalar<S, D, Swap>(&src[x * S], &dst[x * D], w - x, alpha);
+}
+
+// only the 32-bit outputs gain from 256-bit lanes, the rest stay on SSSE3
+template<int S, int D, bool Swap>
+__attribute__((target("avx2")))
+static void rowAVX2(const Uint8 *src, Uint8 *dst, int w, Uint8 alpha) {
+  static const __m128i mask128 = shuffleMask<S, D, Swap>();
+  const __m256i mask = _mm256_broadcastsi128_si256(mask128);
+  const __m256i fill = _mm256_set1_epi32(int(Uint32(alpha) << 24));
+  int x = 0;
+  if (S == 3) {
+    for (; x + 10 <= w; x += 8) {
+      __m128i lo = _mm_loadu_si128((const __m128i*) &src[x * 3]);
+      __m128i hi = _mm_loadu_si128((const __m128i*) &src[x * 3 + 12]);
+      __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+      v = _mm256_or_si256(_mm256_shuffle_epi8(v, mask), fill);
+      _mm256_storeu_si256((__m256i*) &dst[x * 4], v);
+    }
+  } else {
+    for (; x + 8 <= w; x += 8) {
+      __m256i v = _mm256_loadu_si256((const __m256i*) &src[x * 4]);
+      _mm256_storeu_si256((__m256i*) &dst[x * 4], _mm256_shuffle_epi8(v, mask));
+    }
+  }
+  rowSSSE3<S, D, Swap>(&src[x * S], &dst[x * D], w - x, alpha);
+}
+
+template<int S, int D, bool Swap>
+static RowFn pickRow() {
+  static const int level = __builtin_cpu_supports("avx2") ? 2 : __builtin_cpu_supports("ssse3") ? 1 : 0;
+  if (level == 2 && D == 4)
+    return rowAVX2<S, D, Swap>;
+  if (level >= 1)
+    return rowSSSE3<S, D, Swap>;
+  return rowScalar<S, D, Swap>;
+}
+
+// null when rows can simply be copied
+static RowFn pickRow(int srcBytes, int dstBytes, bool swap) {
+  if (srcBytes == 3 && dstBytes == 3)
+    return swap ? pickRow<3, 3, true>() : nullptr;
+  if (srcBytes == 3 && dstBytes == 4)
+    return swap ? pickRow<3, 4, true>() : pickRow<3, 4, false>();
+  if (srcBytes == 4 && dstBytes == 3)
+    return swap ? pickRow<4, 3, true>() : pickRow<4, 3, false>();
+  return swap ? pickRow<4, 4, true>() : nullptr;
+}
+
+bool sdl2::convert(const Pixels &src, PixelLayout srcLayout, Pixels &dst, PixelLayout dstLayout, Uint8 alpha) {
+  if (!src.hasData() || !dst.hasData())
+    return false;
+  if (src.bpp != bitsPerPixel(srcLayout) || dst.bpp != bitsPerPixel(dstLayout))
+    return false;
+
+  int srcBytes = src.bpp / 8;
+  int dstBytes = dst.bpp / 8;
+  int w = std::min(src.w, dst.w);
+  int h = std::min(src.h, dst.h);
+  RowFn row = pickRow(srcBytes, dstBytes, isBGR(srcLayout) != isBGR(dstLayout));
+
+  for (int y = 0; y < h; y++) {
+    const Uint8 *in = rowOf(src, y);
+    Uint8 *out = rowOf(dst, y);
+    if (row)
+      row(in, out, w, alpha);
+    else if (in != out)
+      memmove(out, in, size_t(w) * dstBytes);
+  }
+  return true;
+}
+
+bool sdl2::unpack(const Pixels &src, PixelLayout layout, float *r, float *g, float *b, float *a, int stride) {
+  if (!src.hasData() || src.bpp != bitsPerPixel(layout) || !r || !g || !b || stride < src.w)
+    return false;
+
+  constexpr float inv255 = 1.0f / 255.0f;
+  int rOff = isBGR(layout) ? 2 : 0;
+  int bOff = 2 - rOff;
+  const __m128i lowByte = _mm_set1_epi32(0xff);
+  const __m128 scale = _mm_set1_ps(inv255);
+
+  for (int y = 0; y < src.h; y++) {
+    const Uint8 *in = rowOf(src, y);
+    float *rRow = &r[y * stride], *gRow = &g[y * stride], *bRow = &b[y * stride];
+    float *aRow = a ? &a[y * stride] : nullptr;
+    int x = 0;
+    if (src.bpp == 32) {
+      for (; x + 4 <= src.w; x += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*) &in[x * 4]);
+        __m128i cr = _mm_and_si128(_mm_srl_epi32(v, _mm_cvtsi32_si128(rOff * 8)), lowByte);
+        __m128i cg = _mm_and_si128(_mm_srli_epi32(v, 8), lowByte);
+        __m128i cb = _mm_and_si128(_mm_srl_epi32(v, _mm_cvtsi32_si128(bOff * 8)), lowByte);
+        _mm_storeu_ps(&rRow[x], _mm_mul_ps(_mm_cvtepi32_ps(cr), scale));
+        _mm_storeu_ps(&gRow[x], _mm_mul_ps(_mm_cvtepi32_ps(cg), scale));
+        _mm_storeu_ps(&bRow[x], _mm_mul_ps(_mm_cvtepi32_ps(cb), scale));
+        if (aRow)
+          _mm_storeu_ps(&aRow[x], _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(v, 24)), scale));
+      }
+    }
+    int bytes = src.bpp / 8;
+    for (; x < src.w; x++) {
+      const Uint8 *pixel = &in[x * bytes];
+      rRow[x] = float(pixel[rOff]) * inv255;
+      gRow[x] = float(pixel[1]) * inv255;
+      bRow[x] = float(pixel[bOff]) * inv255;
+      if (aRow)
+        aRow[x] = bytes == 4 ? float(pixel[3]) * inv255 : 1.0f;
+    }
+  }
+  return true;
+}
+
+// both toByte()s round half up (+0.5 then truncate), so a value packs to the
+// same byte whichever path its column takes; cvtps would round half to even
+static inline __m128i toByte(const float *plane) {
+  const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), _255 = _mm_set1_ps(255.0f),
+      half = _mm_set1_ps(0.5f);
+  __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(plane), zero), one);
+  return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, _255), half));
+}
+
+static inline Uint8 toByte(float value) {
+  return Uint8(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+bool sdl2::pack(const float *r, const float *g, const float *b, const float *a, int stride, Pixels &dst,
+                PixelLayout layout) {
+  if (!dst.hasData() || dst.bpp != bitsPerPixel(layout) || !r || !g || !b || stride < dst.w)
+    return false;
+
+  int rOff = isBGR(layout) ? 2 : 0;
+  int bOff = 2 - rOff;
+  const __m128i opaque = _mm_set1_epi32(int(0xff000000u));
+
+  for (int y = 0; y < dst.h; y++) {
+    Uint8 *out = rowOf(dst, y);
+    const float *rRow = &r[y * stride], *gRow = &g[y * stride], *bRow = &b[y * stride];
+    const float *aRow = a ? &a[y * stride] : nullptr;
+    int x = 0;
+    if (dst.bpp == 32) {
+      for (; x + 4 <= dst.w; x += 4) {
+        __m128i v = _mm_sll_epi32(toByte(&rRow[x]), _mm_cvtsi32_si128(rOff * 8));
+        v = _mm_or_si128(v, _mm_slli_epi32(toByte(&gRow[x]), 8));
+        v = _mm_or_si128(v, _mm_sll_epi32(toByte(&bRow[x]), _mm_cvtsi32_si128(bOff * 8)));
+        v = _mm_or_si128(v, aRow ? _mm_slli_epi32(toByte(&aRow[x]), 24) : opaque);
+        _mm_storeu_si128((__m128i*) &out[x * 4], v);
+      }
+    }
+    int bytes = dst.bpp / 8;
+    for (; x < dst.w; x++) {
+      Uint8 *pixel = &out[x * bytes];
+      pixel[rOff] = toByte(rRow[x]);
+      pixel[1] = toByte(gRow[x]);
+      pixel[bOff] = toByte(bRow[x]);
+      if (bytes == 4)
+        pixel[3] = aRow ? toByte(aRow[x]) : 255;
+    }
+  }
+  return true;
+}
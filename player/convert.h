@@ -0,0 +1,30 @@
+#pragma once
+
+#include "mysdl2.h"
+
+namespace sdl2 {
+
+// byte order in memory, Pixel24 is BGR24 and Pixel32 is BGRA32
+enum PixelLayout {
+  RGB24,
+  BGR24,
+  RGBA32,
+  BGRA32
+};
+
+inline int bitsPerPixel(PixelLayout layout) {
+  return layout == RGB24 || layout == BGR24 ? 24 : 32;
+}
+
+// Converts the overlapping area of src and dst row by row, honouring pitch
+// and 'inverted' on both sides. 'alpha' fills the alpha byte when going from
+// 24 to 32 bits. Converting in place is fine when both layouts are the same
+// size. Returns false if either side's bpp doesn't match its layout.
+bool convert(const Pixels &src, PixelLayout srcLayout, Pixels &dst, PixelLayout dstLayout, Uint8 alpha = 255);
+
+// Float planes hold one channel each in [0, 1], 'stride' floats apart per
+// row. 'a' may be null; unpacking 24-bit data into it writes 1.0f.
+bool unpack(const Pixels &src, PixelLayout layout, float *r, float *g, float *b, float *a, int stride);
+bool pack(const float *r, const float *g, const float *b, const float *a, int stride, Pixels &dst, PixelLayout layout);
+
+}
@@ -0,0 +1,34 @@
+#include "exchange.h"
+
+using namespace sdl2;
+
+bool FrameExchange::init(int w, int h, int bpp) {
+  for (auto &slot : slots) {
+    slot = SurfacePool::shared().acquire(w, h, bpp);
+    if (!slot.hasData())
+      return false;
+    memset(slot.pixels.data, 0, size_t(slot.pixels.p) * h);
+  }
+  middle = 1;
+  backIndex = 0;
+  frontIndex = 2;
+  return true;
+}
+
+void FrameExchange::publish() {
+  backIndex = middle.exchange(backIndex | Fresh, std::memory_order_acq_rel) & 3;
+  published++;
+}
+
+void FrameExchange::release() {
+  for (auto &slot : slots)
+    slot.release();
+}
+
+bool FrameExchange::acquire() {
+  if (!(middle.load(std::memory_order_relaxed) & Fresh))
+    return false;
+  frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & 3;
+  acquired++;
+  return true;
+}
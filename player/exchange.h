@@ -0,0 +1,39 @@
+#pragma once
+
+#include "mysdl2.h"
+#include "surfaces.h"
+
+#include <atomic>
+
+namespace sdl2 {
+
+// Lock-free triple buffer between one producer and one consumer thread. The
+// producer fills back() and publish()es it, the consumer calls acquire() and
+// reads front(). Nobody waits: frames the consumer didn't get to are simply
+// overwritten, and front() stays put until something newer comes along.
+struct FrameExchange {
+  static constexpr int Fresh = 4;  // set in 'middle' until the consumer takes it
+
+  PooledSurface slots[3];
+  std::atomic<int> middle { 1 };
+  int backIndex = 0, frontIndex = 2;
+  std::atomic<Uint32> published { 0 }, acquired { 0 };
+
+  // all three slots w x h x bpp, cleared to black
+  bool init(int w, int h, int bpp);
+
+  Pixels& back() {
+    return slots[backIndex].pixels;
+  }
+  Pixels& front() {
+    return slots[frontIndex].pixels;
+  }
+
+  void publish();
+  // true if front() changed since the last call
+  bool acquire();
+  // hands the slots back to the pool, once neither side uses them anymore
+  void release();
+};
+
+}
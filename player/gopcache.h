@@ -0,0 +1,358 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <algorithm>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+#include <libavutil/imgutils.h>
+}
+
+#include "source.h"
+
+// Decoded GOPs kept for stepping and reverse playback. A GOP is decoded
+// whole, on a thread of its own with its own demuxer and codec, and kept
+// either as the decoder's frames (scale 1, no copy) or as 1/scale size
+// YUV 4:2:0 copies. Past 'budget' bytes the least recently used GOPs go,
+// except the one served last.
+//
+// step() answers from the cache where it can and waits for the GOP it needs
+// where it can't; either way it queues the neighbouring GOP in the direction
+// of travel, so stepping or playing backwards at a steady pace only ever
+// waits on the first GOP.
+struct GopCache {
+  struct Gop {
+    int64_t start = 0, end = INT64_MAX;  // keyframe pts, next keyframe pts
+    std::vector<AVFrame*> frames;  // pts order
+    size_t bytes = 0;
+    uint64_t used = 0;
+  };
+
+  static constexpr size_t MaxWanted = 4;
+
+  std::string url;
+  size_t budget = size_t(256) << 20;
+  int scale = 1;
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<int64_t> keyframes;
+  bool reorders = false;
+  std::map<int64_t, Gop> gops;  // by start
+  size_t bytes = 0;
+  uint64_t tick = 0;
+  std::deque<int64_t> wanted;  // GOP starts for the worker, most urgent first
+  int64_t busy = INT64_MIN, pinned = INT64_MIN;
+  bool quit = false;
+  uint64_t hits = 0, misses = 0, evictions = 0, decodedGops = 0;
+  std::thread worker;
+
+  // worker side
+  std::unique_ptr<Source> source;  // instead of opening 'url', if set
+  AVFormatContext *fmtCtx = nullptr;
+  AVCodecContext *codecCtx = nullptr;
+  SwsContext *swsCtx = nullptr;
+  int vidStream = -1;
+
+  GopCache(std::string_view url_, size_t budget_ = size_t(256) << 20,
+           int scale_ = 1, std::unique_ptr<Source> source_ = nullptr)
+      :
+      url(url_),
+      budget(budget_),
+      scale(std::max(1, scale_)),
+      source(std::move(source_)) {
+  }
+
+  GopCache(const GopCache&) = delete;
+  GopCache& operator =(const GopCache&) = delete;
+
+  ~GopCache() {
+    {
+      std::lock_guard<std::mutex> lg(mutex);
+      quit = true;
+    }
+    if (source)
+      source->abort();  // a worker stuck on a stalled read
+    cv.notify_all();
+    if (worker.joinable())
+      worker.join();
+    for (auto &it : gops)
+      for (auto f : it.second.frames)
+        av_frame_free(&f);
+    sws_freeContext(swsCtx);
+    if (codecCtx)
+      avcodec_free_context(&codecCtx);
+    if (fmtCtx)
+      avformat_close_input(&fmtCtx);
+  }
+
+  bool open() {
+    int resp =
+        source ?
+            source->open(&fmtCtx, url.c_str()) :
+            avformat_open_input(&fmtCtx, url.c_str(), nullptr, nullptr);
+    if (resp != 0) {
+      printf("GopCache failed to open '%s'\n", url.c_str());
+      return false;
+    }
+    avformat_find_stream_info(fmtCtx, nullptr);
+    vidStream = av_find_best_stream(fmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1,
+                                    nullptr, 0);
+    if (vidStream < 0)
+      return false;
+    AVCodecParameters *par = fmtCtx->streams[vidStream]->codecpar;
+    // setKeyframes() can only add to this, a sidecar index may predate it
+    reorders = par->video_delay > 0;
+    const AVCodec *codec = avcodec_find_decoder(par->codec_id);
+    codecCtx = avcodec_alloc_context3(codec);
+    avcodec_parameters_to_context(codecCtx, par);
+    codecCtx->thread_count = 0;  // a cold GOP is what the user waits on
+    if (!codec || avcodec_open2(codecCtx, codec, nullptr) < 0) {
+      printf("GopCache: no decoder for '%s'\n", url.c_str());
+      return false;
+    }
+    worker = std::thread(&GopCache::work, this);
+    return true;
+  }
+
+  // 'pts' as in KeyframeIndex: GOP bounds are keyframe pts, never dts
+  void setKeyframes(const std::vector<int64_t> &pts, bool reorders_) {
+    std::lock_guard<std::mutex> lg(mutex);
+    keyframes = pts;
+    reorders = reorders || reorders_;
+  }
+
+  bool hasKeyframes() {
+    std::lock_guard<std::mutex> lg(mutex);
+    return !keyframes.empty();
+  }
+
+  // The frame next to 'pts': the last one before it (dir < 0), the first one
+  // after it (dir > 0) or the one showing at it (dir = 0). A new reference
+  // for the caller to free, nullptr past either end.
+  AVFrame* step(int64_t pts, int dir) {
+    std::unique_lock<std::mutex> lk(mutex);
+    if (keyframes.empty())
+      return nullptr;
+    auto it = std::upper_bound(keyframes.begin(), keyframes.end(), pts);
+    size_t i = it == keyframes.begin() ? 0 : size_t(it - keyframes.begin()) - 1;
+    while (true) {
+      Gop *gop = fetch(i, lk);
+      if (!gop)
+        return nullptr;
+      const AVFrame *found = nullptr;
+      for (auto f : gop->frames)
+        if (dir < 0 ? f->pts < pts : dir > 0 ? f->pts > pts : f->pts <= pts) {
+          found = f;
+          if (dir > 0)
+            break;
+        }
+      if (!found && dir == 0 && !gop->frames.empty())
+        found = gop->frames.front();
+      if (found) {
+        if (dir <= 0 && i > 0)
+          want(keyframes[i - 1], false);
+        if (dir >= 0 && i + 1 < keyframes.size())
+          want(keyframes[i + 1], false);
+        AVFrame *copy = av_frame_alloc();
+        av_frame_ref(copy, found);
+        return copy;
+      }
+      // the neighbour lives in the next GOP over
+      if (dir < 0 && i > 0)
+        i--;
+      else if (dir > 0 && i + 1 < keyframes.size())
+        i++;
+      else
+        return nullptr;
+    }
+  }
+
+  void report() {
+    std::lock_guard<std::mutex> lg(mutex);
+    printf("GopCache: %zu GOPs, %.1f of %.1f MB, %llu hits, %llu misses, "
+           "%llu decoded, %llu evicted\n",
+           gops.size(), bytes / 1048576.0, budget / 1048576.0,
+           (unsigned long long) hits, (unsigned long long) misses,
+           (unsigned long long) decodedGops, (unsigned long long) evictions);
+  }
+
+  // the rest expects the lock held
+
+  // GOP 'i', waiting for the worker if it isn't cached yet
+  Gop* fetch(size_t i, std::unique_lock<std::mutex> &lk) {
+    int64_t start = keyframes[i];
+    auto it = gops.find(start);
+    if (it != gops.end())
+      hits++;
+    else {
+      misses++;
+      // asks again on every wakeup, in case it got evicted before we woke
+      while (!quit && !gops.count(start)) {
+        want(start, true);
+        cv.wait(lk);
+      }
+      if (quit)
+        return nullptr;
+      it = gops.find(start);
+    }
+    it->second.used = ++tick;
+    pinned = start;
+    return &it->second;
+  }
+
+  void want(int64_t start, bool urgent) {
+    if (busy == start || gops.count(start))
+      return;
+    wanted.erase(std::remove(wanted.begin(), wanted.end(), start),
+                 wanted.end());
+    if (urgent)
+      wanted.push_front(start);
+    else
+      wanted.push_back(start);
+    // stepping faster than GOPs decode: old prefetches are stale by now
+    while (wanted.size() > MaxWanted)
+      wanted.pop_back();
+    cv.notify_all();
+  }
+
+  // never the GOP served last, nor 'fresh', which somebody may wait on
+  void evict(int64_t fresh) {
+    while (bytes > budget && gops.size() > 1) {
+      auto lru = gops.end();
+      for (auto it = gops.begin(); it != gops.end(); it++)
+        if (it->first != pinned && it->first != fresh
+            && (lru == gops.end() || it->second.used < lru->second.used))
+          lru = it;
+      if (lru == gops.end())
+        return;
+      for (auto f : lru->second.frames)
+        av_frame_free(&f);
+      bytes -= lru->second.bytes;
+      gops.erase(lru);
+      evictions++;
+    }
+  }
+
+  void work() {
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    std::unique_lock<std::mutex> lk(mutex);
+    while (true) {
+      cv.wait(lk, [this]() {
+        return quit || !wanted.empty();
+      });
+      if (quit)
+        break;
+      Gop gop;
+      gop.start = wanted.front();
+      wanted.pop_front();
+      if (gops.count(gop.start))
+        continue;
+      auto next = std::upper_bound(keyframes.begin(), keyframes.end(),
+                                   gop.start);
+      gop.end = next != keyframes.end() ? *next : INT64_MAX;
+      bool reorder = reorders;  // setKeyframes() may change it meanwhile
+      busy = gop.start;
+      lk.unlock();
+      decode(gop, packet, frame, reorder);
+      lk.lock();
+      busy = INT64_MIN;
+      gop.used = ++tick;
+      bytes += gop.bytes;
+      decodedGops++;
+      // an empty GOP still goes in, so nobody waits on it forever
+      int64_t start = gop.start;
+      gops[start] = std::move(gop);
+      evict(start);
+      cv.notify_all();
+    }
+    lk.unlock();
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+  }
+
+  // same cut as BatchDecoder::decodeSegment(): [start, end), plus the next
+  // keyframe's leading pictures when the stream reorders ('reorder', as
+  // work() read 'reorders' under the lock)
+  void decode(Gop &gop, AVPacket *packet, AVFrame *frame, bool reorder) {
+    avcodec_flush_buffers(codecCtx);
+    if (av_seek_frame(fmtCtx, vidStream, gop.start, AVSEEK_FLAG_BACKWARD) < 0) {
+      printf("GopCache: seek to %lld failed\n", (long long) gop.start);
+      return;
+    }
+    auto receive = [&]() {
+      while (avcodec_receive_frame(codecCtx, frame) >= 0) {
+        int64_t pts = frame->best_effort_timestamp;
+        if (pts == AV_NOPTS_VALUE || pts < gop.start || pts >= gop.end)
+          av_frame_unref(frame);
+        else
+          keep(gop, frame, pts);
+      }
+    };
+    bool tail = false;
+    while (av_read_frame(fmtCtx, packet) >= 0) {
+      if (packet->stream_index != vidStream) {
+        av_packet_unref(packet);
+        continue;
+      }
+      int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+      if (pts != AV_NOPTS_VALUE && pts >= gop.end) {
+        if (tail || !reorder || !(packet->flags & AV_PKT_FLAG_KEY)) {
+          av_packet_unref(packet);
+          break;
+        }
+        tail = true;
+      }
+      avcodec_send_packet(codecCtx, packet);
+      av_packet_unref(packet);
+      receive();
+    }
+    avcodec_send_packet(codecCtx, nullptr);
+    receive();
+    std::sort(gop.frames.begin(), gop.frames.end(),
+              [](const AVFrame *a, const AVFrame *b) {
+                return a->pts < b->pts;
+              });
+  }
+
+  void keep(Gop &gop, AVFrame *frame, int64_t pts) {
+    AVFrame *kept = av_frame_alloc();
+    if (scale == 1)
+      av_frame_move_ref(kept, frame);
+    else {
+      kept->format = AV_PIX_FMT_YUV420P;
+      kept->width = std::max(2, frame->width / scale);
+      kept->height = std::max(2, frame->height / scale);
+      swsCtx = sws_getCachedContext(swsCtx, frame->width, frame->height,
+                                    AVPixelFormat(frame->format), kept->width,
+                                    kept->height, AV_PIX_FMT_YUV420P, SWS_AREA,
+                                    nullptr, nullptr, nullptr);
+      if (!swsCtx || av_frame_get_buffer(kept, 0) < 0) {
+        av_frame_free(&kept);
+        av_frame_unref(frame);
+        return;
+      }
+      sws_scale(swsCtx, frame->data, frame->linesize, 0, frame->height,
+                kept->data, kept->linesize);
+      av_frame_unref(frame);
+    }
+    kept->pts = kept->best_effort_timestamp = pts;
+    gop.bytes += size_t(
+        av_image_get_buffer_size(AVPixelFormat(kept->format), kept->width,
+                                 kept->height, 1));
+    gop.frames.push_back(kept);
+  }
+};
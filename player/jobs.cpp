@@ -0,0 +1,146 @@
+#include "jobs.h"
+
+#include <algorithm>
+#include <numeric>
+
+using namespace sdl2;
+
+static thread_local bool inJob = false;
+
+Jobs::Jobs(int threads) {
+  if (threads <= 0)
+    threads = std::max(1, SDL_GetCPUCount());
+  for (int i = 1; i < threads; i++)
+    workers.emplace_back(&Jobs::work, this);
+}
+
+Jobs::~Jobs() {
+  {
+    std::lock_guard<std::mutex> lg(mutex);
+    quit = true;
+  }
+  wake.notify_all();
+  for (auto &worker : workers)
+    worker.join();
+}
+
+Jobs& Jobs::shared() {
+  static Jobs jobs;
+  return jobs;
+}
+
+void Jobs::run(Batch &batch, int lane) {
+  inJob = true;
+  int numLanes = int(batch.lanes.size());
+  for (int k = 0; k < numLanes; k++) {
+    Lane &from = batch.lanes[(lane + k) % numLanes];
+    while (true) {
+      int chunk = from.next.fetch_add(1, std::memory_order_relaxed);
+      if (chunk >= from.end)
+        break;
+      int begin = chunk * batch.grain;
+      (*batch.fn)(begin, std::min(begin + batch.grain, batch.count));
+    }
+  }
+  inJob = false;
+}
+
+void Jobs::work() {
+  Uint64 seen = 0;
+  std::unique_lock<std::mutex> lk(mutex);
+  while (true) {
+    wake.wait(lk, [&]() {
+      return quit || (batch && batch->gen != seen);
+    });
+    if (quit)
+      break;
+    Batch *current = batch;
+    seen = current->gen;
+    int lane = 1 + current->joined.fetch_add(1);
+    busy++;
+    lk.unlock();
+    run(*current, lane % int(current->lanes.size()));
+    lk.lock();
+    if (!--busy)
+      idle.notify_all();
+  }
+}
+
+void Jobs::parallelFor(int count, int grain, const std::function<void(int begin, int end)> &fn) {
+  if (count <= 0)
+    return;
+  grain = std::max(grain, 1);
+  int chunks = (count + grain - 1) / grain;
+  if (inJob || workers.empty() || chunks == 1) {
+    fn(0, count);
+    return;
+  }
+
+  std::lock_guard<std::mutex> call(callMutex);
+  Batch current;
+  current.fn = &fn;
+  current.count = count;
+  current.grain = grain;
+  current.lanes = std::vector<Lane>(std::min(size(), chunks));
+  int numLanes = int(current.lanes.size());
+  for (int i = 0; i < numLanes; i++) {
+    current.lanes[i].next = chunks * i / numLanes;
+    current.lanes[i].end = chunks * (i + 1) / numLanes;
+  }
+  {
+    std::lock_guard<std::mutex> lg(mutex);
+    current.gen = ++gen;
+    batch = &current;
+  }
+  wake.notify_all();
+
+  run(current, 0);
+
+  // no new joiners once the batch is withdrawn, then wait out the stragglers
+  std::unique_lock<std::mutex> lk(mutex);
+  batch = nullptr;
+  idle.wait(lk, [this]() {
+    return busy == 0;
+  });
+}
+
+void Jobs::parallelRows(Pixels &pixels, const std::function<void(Pixels &band, int y0)> &fn, int minRows) {
+  if (!pixels.hasData())
+    return;
+  // rows per band such that every band starts a whole number of cache lines
+  // after the first, and enough bands to keep everyone busy
+  int align = 64 / std::gcd(std::max(pixels.p, 1), 64);
+  int rows = std::max(minRows, (pixels.h + size() * 4 - 1) / (size() * 4));
+  rows = (rows + align - 1) / align * align;
+
+  parallelFor(pixels.h, rows, [&](int y0, int y1) {
+    Pixels band = pixels;
+    band.h = y1 - y0;
+    band.data = &pixels.data[(pixels.inverted ? pixels.h - y1 : y0) * pixels.p];
+    fn(band, y0);
+  });
+}
+
+void Jobs::parallelTiles(Pixels &pixels, int tileW, int tileH, const std::function<void(Pixels &tile, int x0, int y0)> &fn) {
+  if (!pixels.hasData())
+    return;
+  int bytes = std::max(pixels.bpp / 8, 1);
+  int align = 64 / std::gcd(bytes, 64);
+  tileW = std::max((tileW + align - 1) / align * align, align);
+  tileH = std::max(tileH, 1);
+  int cols = (pixels.w + tileW - 1) / tileW;
+  int rows = (pixels.h + tileH - 1) / tileH;
+
+  parallelFor(cols * rows, 1, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      int x0 = (i % cols) * tileW;
+      int y0 = (i / cols) * tileH;
+      int y1 = std::min(y0 + tileH, pixels.h);
+      Pixels tile = pixels;
+      tile.w = std::min(tileW, pixels.w - x0);
+      tile.h = y1 - y0;
+      tile.data = &pixels.data[(pixels.inverted ? pixels.h - y1 : y0) * pixels.p + x0 * bytes];
+      fn(tile, x0, y0);
+    }
+  });
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "mysdl2.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sdl2 {
+
+// Persistent worker pool for data-parallel passes. Each call splits its range
+// into chunks dealt out evenly to the workers (the caller being one of
+// them); anyone who runs dry steals chunks from the others. Calls from inside
+// a job run serially on the calling thread.
+struct Jobs {
+  struct alignas(64) Lane {
+    std::atomic<int> next { 0 };
+    int end = 0;
+  };
+
+  struct Batch {
+    const std::function<void(int begin, int end)> *fn = nullptr;
+    int count = 0, grain = 1;
+    std::vector<Lane> lanes;
+    std::atomic<int> joined { 0 };
+    Uint64 gen = 0;
+  };
+
+  std::vector<std::thread> workers;
+  std::mutex mutex, callMutex;
+  std::condition_variable wake, idle;
+  Batch *batch = nullptr;
+  Uint64 gen = 0;
+  int busy = 0;
+  bool quit = false;
+
+  Jobs(int threads = 0);  // 0 = one per core
+  Jobs(const Jobs&) = delete;
+  Jobs& operator =(const Jobs&) = delete;
+  ~Jobs();
+
+  static Jobs& shared();
+
+  int size() const {
+    return int(workers.size()) + 1;
+  }
+
+  // fn(begin, end) over [0, count) in chunks of at least 'grain'
+  void parallelFor(int count, int grain, const std::function<void(int begin, int end)> &fn);
+
+  // fn(band, y0) over horizontal bands of 'pixels', 'band' being a view whose
+  // row 0 is row y0 of 'pixels'; bands start on 64 byte boundaries whenever
+  // the data pointer itself is aligned
+  void parallelRows(Pixels &pixels, const std::function<void(Pixels &band, int y0)> &fn, int minRows = 4);
+
+  // fn(tile, x0, y0) over tiles of roughly tileW x tileH, tile widths are
+  // rounded to whole cache lines
+  void parallelTiles(Pixels &pixels, int tileW, int tileH, const std::function<void(Pixels &tile, int x0, int y0)> &fn);
+
+  void work();
+  void run(Batch &batch, int lane);
+};
+
+}
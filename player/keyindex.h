@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+#include <sys/stat.h>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+}
+
+// Sorted keyframe pts of one video stream (stream time base). Taken from the
+// container's own index where there is one, otherwise by reading through the
+// packets, which is slow enough to be worth a sidecar file.
+struct KeyframeIndex {
+  static constexpr uint32_t Magic = 0x3149464b;  // "KFI1"
+
+  std::vector<int64_t> pts;
+  bool reorders = false;  // pts and dts differ somewhere: B-frames
+
+  bool empty() const {
+    return pts.empty();
+  }
+
+  // last keyframe at or before 't', INT64_MIN if there is none
+  int64_t before(int64_t t) const {
+    auto it = std::upper_bound(pts.begin(), pts.end(), t);
+    return it == pts.begin() ? INT64_MIN : *(it - 1);
+  }
+
+  // The container's own index, no reads. It holds dts (mov's does, for one),
+  // which only equal pts when nothing reorders: with 'reorders' set, 'pts'
+  // are dts until keyPts() has run.
+  bool fromContainer(AVFormatContext *fmtCtx, int stream) {
+    pts.clear();
+    AVStream *st = fmtCtx->streams[stream];
+    int entries = avformat_index_get_entries_count(st);
+    for (int i = 0; i < entries; i++) {
+      const AVIndexEntry *entry = avformat_index_get_entry(st, i);
+      if (entry->flags & AVINDEX_KEYFRAME)
+        pts.push_back(entry->timestamp);
+    }
+    std::sort(pts.begin(), pts.end());
+    reorders = st->codecpar->video_delay > 0;
+    return !pts.empty();
+  }
+
+  // Turns fromContainer()'s dts into pts by reading every keyframe's packet:
+  // a seek and a packet per keyframe, no decoding, too slow for anything
+  // remote. 'cancel' stops it early (and leaves the index empty). Leaves
+  // 'fmtCtx' at the first keyframe.
+  bool keyPts(AVFormatContext *fmtCtx, int stream,
+              const std::atomic<bool> *cancel = nullptr) {
+    if (!reorders || pts.empty())
+      return !pts.empty();
+    std::vector<int64_t> dts = std::move(pts);
+    pts.clear();
+    AVPacket *packet = av_packet_alloc();
+    int64_t offset = 0;  // pts - dts of the last keyframe read, for misses
+    for (int64_t t : dts) {
+      if (cancel && *cancel) {
+        pts.clear();
+        break;
+      }
+      int64_t found = AV_NOPTS_VALUE;
+      if (av_seek_frame(fmtCtx, stream, t, AVSEEK_FLAG_BACKWARD) >= 0)
+        while (av_read_frame(fmtCtx, packet) >= 0) {
+          bool ours = packet->stream_index == stream;
+          if (ours && (packet->flags & AV_PKT_FLAG_KEY)
+              && packet->pts != AV_NOPTS_VALUE) {
+            found = packet->pts;
+            if (packet->dts != AV_NOPTS_VALUE)
+              offset = packet->pts - packet->dts;
+          }
+          av_packet_unref(packet);
+          if (ours)
+            break;
+        }
+      pts.push_back(found != AV_NOPTS_VALUE ? found : t + offset);
+    }
+    av_packet_free(&packet);
+    av_seek_frame(fmtCtx, stream, dts.front(), AVSEEK_FLAG_BACKWARD);
+    std::sort(pts.begin(), pts.end());
+    pts.erase(std::unique(pts.begin(), pts.end()), pts.end());
+    return !pts.empty();
+  }
+
+  bool fromStream(AVFormatContext *fmtCtx, int stream) {
+    return fromContainer(fmtCtx, stream) && keyPts(fmtCtx, stream);
+  }
+
+  // reads every packet of 'fmtCtx' from where it stands, no decoding;
+  // 'cancel' stops it early (and leaves the index empty)
+  bool scan(AVFormatContext *fmtCtx, int stream,
+            const std::atomic<bool> *cancel = nullptr) {
+    pts.clear();
+    AVPacket *packet = av_packet_alloc();
+    while (av_read_frame(fmtCtx, packet) >= 0) {
+      if (cancel && *cancel) {
+        pts.clear();
+        break;
+      }
+      if (packet->stream_index == stream) {
+        if (packet->flags & AV_PKT_FLAG_KEY)
+          pts.push_back(
+              packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts);
+        if (packet->pts != AV_NOPTS_VALUE && packet->dts != AV_NOPTS_VALUE
+            && packet->pts != packet->dts)
+          reorders = true;
+      }
+      av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
+    std::sort(pts.begin(), pts.end());
+    return !pts.empty();
+  }
+
+  // size and modification time of a local file, false for anything else
+  static bool stamp(const std::string &path, int64_t &size, int64_t &mtime) {
+    if (path.find("://") != std::string::npos)
+      return false;
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+      return false;
+    size = int64_t(info.st_size);
+    mtime = int64_t(info.st_mtime);
+    return true;
+  }
+
+  // Sidecar: magic, source size and mtime, reorder flag, count, timestamps.
+  // A sidecar whose stamp doesn't match the source is ignored.
+  bool load(const std::string &path, int64_t size, int64_t mtime) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+      return false;
+    uint32_t magic = 0, flags = 0;
+    int64_t fileSize = 0, fileTime = 0;
+    uint64_t count = 0;
+    bool ok = fread(&magic, 4, 1, f) == 1 && magic == Magic
+        && fread(&fileSize, 8, 1, f) == 1 && fileSize == size
+        && fread(&fileTime, 8, 1, f) == 1 && fileTime == mtime
+        && fread(&flags, 4, 1, f) == 1 && fread(&count, 8, 1, f) == 1
+        && count < (1ull << 32);
+    if (ok) {
+      pts.resize(size_t(count));
+      ok = fread(pts.data(), 8, pts.size(), f) == pts.size();
+      reorders = flags & 1;
+    }
+    fclose(f);
+    if (!ok)
+      pts.clear();
+    return ok && !pts.empty();
+  }
+
+  bool save(const std::string &path, int64_t size, int64_t mtime) const {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f)
+      return false;
+    uint32_t flags = reorders ? 1 : 0;
+    uint64_t count = pts.size();
+    bool ok = fwrite(&Magic, 4, 1, f) == 1 && fwrite(&size, 8, 1, f) == 1
+        && fwrite(&mtime, 8, 1, f) == 1 && fwrite(&flags, 4, 1, f) == 1
+        && fwrite(&count, 8, 1, f) == 1
+        && fwrite(pts.data(), 8, pts.size(), f) == pts.size();
+    fclose(f);
+    if (!ok)
+      remove(path.c_str());
+    return ok;
+  }
+};
@@ -0,0 +1,115 @@
+#include "loop.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+using namespace sdl2;
+
+void TimingStats::record(double ms) {
+  recent[count % Window] = ms;
+  count++;
+  if (count == 1) {
+    minMs = maxMs = meanMs = ms;
+    m2 = 0.0;
+    return;
+  }
+  minMs = std::min(minMs, ms);
+  maxMs = std::max(maxMs, ms);
+  double delta = ms - meanMs;
+  meanMs += delta / double(count);
+  m2 += delta * (ms - meanMs);
+}
+
+double TimingStats::stddev() const {
+  return count > 1 ? sqrt(m2 / double(count - 1)) : 0.0;
+}
+
+double TimingStats::percentile(double pct) const {
+  int n = int(std::min<Uint64>(count, Window));
+  if (!n)
+    return 0.0;
+  std::vector<double> sorted(recent, recent + n);
+  int i = std::clamp(int(pct / 100.0 * double(n - 1) + 0.5), 0, n - 1);
+  std::nth_element(sorted.begin(), sorted.begin() + i, sorted.end());
+  return sorted[i];
+}
+
+void TimingStats::report(const char *name) const {
+  if (!count)
+    return;
+  printf("%s: %llu samples, avg %.3f ms (sd %.3f), min %.3f, max %.3f, p99 %.3f\n", name, (unsigned long long) count,
+         meanMs, stddev(), minMs, maxMs, percentile(99.0));
+}
+
+void Loop::sleepUntil(Uint64 target) {
+  while (true) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    if (now >= target)
+      return;
+    double remainingMs = toMs(target - now);
+    if (remainingMs <= sleepErrMs)
+      break;
+    double requestMs = remainingMs - sleepErrMs;
+    std::this_thread::sleep_for(std::chrono::microseconds(Sint64(requestMs * 1e3)));
+    // track oversleep, quick to grow and slow to shrink
+    double overMs = toMs(SDL_GetPerformanceCounter() - now) - requestMs;
+    overMs = std::clamp(overMs, 0.05, 4.0);
+    sleepErrMs = overMs > sleepErrMs ? overMs : sleepErrMs * 0.95 + overMs * 0.05;
+  }
+  while (SDL_GetPerformanceCounter() < target)
+    ;
+}
+
+void Loop::run(std::function<bool()> step, std::function<void(float alpha)> draw) {
+  freq = double(SDL_GetPerformanceFrequency());
+  Uint64 stepTicks = Uint64(freq / stepRate);
+  Uint64 frameTicks = maxFps > 0.0 ? Uint64(freq / maxFps) : 0;
+  Uint64 accum = stepTicks;  // step once before the first draw
+  Uint64 prev = SDL_GetPerformanceCounter();
+
+  running = true;
+  while (running) {
+    Uint64 frameStart = SDL_GetPerformanceCounter();
+    accum += frameStart - prev;
+    if (frames)
+      frameTime.record(toMs(frameStart - prev));
+    prev = frameStart;
+
+    int n = 0;
+    while (accum >= stepTicks && running) {
+      if (n == maxSteps) {
+        // too far behind to catch up, drop the backlog instead of spiralling
+        droppedSteps += accum / stepTicks;
+        accum %= stepTicks;
+        break;
+      }
+      Uint64 begin = SDL_GetPerformanceCounter();
+      if (!step())
+        running = false;
+      stepTime.record(toMs(SDL_GetPerformanceCounter() - begin));
+      accum -= stepTicks;
+      steps++;
+      n++;
+    }
+    if (!running)
+      break;
+
+    Uint64 begin = SDL_GetPerformanceCounter();
+    draw(float(double(accum) / double(stepTicks)));
+    drawTime.record(toMs(SDL_GetPerformanceCounter() - begin));
+    frames++;
+
+    if (frameTicks)
+      sleepUntil(frameStart + frameTicks);
+  }
+}
+
+void Loop::report() const {
+  printf("%llu steps (%llu dropped), %llu frames\n", (unsigned long long) steps, (unsigned long long) droppedSteps,
+         (unsigned long long) frames);
+  stepTime.report("step");
+  drawTime.report("draw");
+  frameTime.report("frame");
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "mysdl2.h"
+
+#include <functional>
+
+namespace sdl2 {
+
+// running min/max/mean/deviation of a timing in ms, plus the last 'Window'
+// samples for percentiles
+struct TimingStats {
+  static constexpr int Window = 1024;
+  Uint64 count = 0;
+  double minMs = 0.0, maxMs = 0.0, meanMs = 0.0, m2 = 0.0;
+  double recent[Window];
+
+  void record(double ms);
+  double stddev() const;
+  double percentile(double pct) const;
+  void report(const char *name) const;
+};
+
+// Fixed-timestep driver: 'step' runs at stepRate Hz, 'draw' gets the fraction
+// of a step left over for interpolation. With maxFps set the loop sleeps off
+// the rest of each frame (spinning only for the last stretch), with maxFps = 0
+// it renders flat out.
+struct Loop {
+  double stepRate = 50.0;
+  double maxFps = 60.0;
+  int maxSteps = 5;  // catch-up limit per frame, the rest of the backlog is dropped
+  bool running = false;
+
+  Uint64 steps = 0, droppedSteps = 0, frames = 0;
+  TimingStats stepTime, drawTime, frameTime;
+
+  double freq = 0.0;
+  double sleepErrMs = 1.0;  // running estimate of how late sleeps wake up
+
+  Loop(double stepRate = 50.0, double maxFps = 60.0)
+      :
+      stepRate(stepRate),
+      maxFps(maxFps) {
+  }
+
+  // 'step' returns false to quit
+  void run(std::function<bool()> step, std::function<void(float alpha)> draw);
+  void stop() {
+    running = false;
+  }
+  void sleepUntil(Uint64 target);
+  double toMs(Uint64 ticks) const {
+    return double(ticks) * 1e3 / freq;
+  }
+  void report() const;
+};
+
+}
@@ -10,9 +10,15 @@
 #include <thread>
 #include <chrono>
 #include <memory>
+#include <algorithm>
 
 #include "mysdl2.h"
+#include "exchange.h"
+#include "loop.h"
 #include "player.h"
+#include "batch.h"
+#include "pool.h"
+#include "surfaces.h"
 
 /*
   Link:
@@ -22,116 +28,197 @@
 
 #define DISP_W 640
 #define DISP_H 480
+#define WIN_W (DISP_W * 2)  // the renderer scales the display up
+#define WIN_H (DISP_H * 2)
 
 using namespace sdl2;
 
 SDL sdl;
 
 std::atomic<bool> run(true);
-std::vector<Pixel24> buffer( DISP_W * DISP_H);
+FrameExchange frames;  // decoder -> renderer, in the display's format
+bool shown = false;
 std::thread work;
-
-std::mutex mut;
+int mosaicCount = 0;
 
 void video(std::string_view url) {
  std::unique_ptr<Player> player = std::make_unique<Player>(url, DISP_W,
                                                             DISP_H);
-  while (run) {
-    auto start = std::chrono::high_resolution_clock::now();
-    player->play();
-    player->decode();
-    {
-      std::lock_guard<std::mutex> lg(mut);
-      for(int i = 0; i < DISP_W * DISP_H; i++){
-        uint8_t *data = &player->buffer[i*3];
-        buffer[i].r = data[0];
-        buffer[i].g = data[1];
-        buffer[i].b = data[2];
-
-      }
-    }
-    auto stop = std::chrono::high_resolution_clock::now();
-    double elapsed =
-        double(
-            std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start)
-                .count()) * 1e-6;
-
-    double delay = 1000.0 / player->fps - elapsed;
-    std::this_thread::sleep_for(std::chrono::milliseconds(int(delay)));
+  // present() paces by pts and drops what's late
+  while (run && player->present()) {
+    // one pass from the decoder's YUV to the display format
+    if (player->decode(frames.back()))
+      frames.publish();
+  }
+  player->report();
+}
+
+// 'count' copies of 'url' in a grid, all on one PlayerPool; the mosaic is
+// copied into the exchange whenever a cell changed
+void wall(std::string_view url, int count) {
+  PooledSurface mosaic = SurfacePool::shared().acquire(DISP_W, DISP_H,
+                                                       frames.back().bpp);
+  mosaic.pixels.clear(Pixel32(0, 0, 0, 255));
+  PlayerPool pool;
+  for (int i = 0; i < count; i++)
+    pool.add(url);
+  pool.layout(mosaic.pixels);
+  pool.start();
+  uint64_t copied = 0;
+  while (run && pool.running()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    if (pool.shown == copied)
+      continue;
+    copied = pool.shown;
+    Pixels &back = frames.back();
+    memcpy(back.data, mosaic.pixels.data, size_t(back.p) * back.h);
+    frames.publish();
   }
+  pool.stop();
+  pool.report();
 }
 
+std::string url =
+    "http://commondatastorage.googleapis.com/gtv-videos-bucket/sample/ElephantsDream.mp4";
+
 void init() {
   printf("*** INIT ***\n");
-  work =
-      std::thread(
-          video,
-          "http://commondatastorage.googleapis.com/gtv-videos-bucket/sample/ElephantsDream.mp4");
+  int bpp = sdl.texture ? SDL_BYTESPERPIXEL(sdl.textureFormat) * 8 : sdl.surf->format->BitsPerPixel;
+  frames.init( DISP_W, DISP_H, bpp);
+  if (mosaicCount > 0)
+    work = std::thread(wall, url, mosaicCount);
+  else
+    work = std::thread(video, url);
   printf("************\n");
 }
 
 void step() {
 }
 
+// only touches the screen when the decoder published something new, the
+// texture or surface keeps showing the last frame otherwise
 void draw() {
+  if (!frames.acquire() && shown)
+    return;
+  shown = true;
+  Pixels &front = frames.front();
+
+  if (sdl.texture) {
+    // straight from the slot, no lock and no copy of our own
+    SDL_UpdateTexture(sdl.texture, nullptr, front.data, front.p);
+    return;
+  }
   auto bg = sdl.lock();
-
-  Pixel24 bgColor(180, 200, 214);
-
-  bg.inverted = false;
-//  for (int y = 0; y < bg.h; y++)
-//    for (int x = 0; x < bg.w; x++)
-//      bg.plot(x, y, bgColor);
-
-  std::lock_guard<std::mutex> lg(mut);
-  for (int y = 0; y < bg.h; y++)
-    for (int x = 0; x < bg.w; x++)
-      bg.plot(x, y, buffer[y * DISP_W + x]);
-
+  if (bg.bpp != front.bpp)
+    return;
+  int rowBytes = std::min(bg.w, front.w) * front.bpp / 8;
+  if (bg.p == front.p && bg.w == front.w)
+    memcpy(bg.data, front.data, size_t(front.p) * std::min(bg.h, front.h));
+  else
+    for (int y = 0; y < std::min(bg.h, front.h); y++)
+      memcpy(&bg.data[y * bg.p], &front.data[y * front.p], rowBytes);
 }
 
 void term() {
   printf("*** TERM ***\n");
   run = false;
   work.join();
+  printf("frames: %u published, %u shown\n", frames.published.load(), frames.acquired.load());
+  frames.release();
   printf("************\n");
 }
 
+// usage: player [--headless <frames> | --batch <workers> | --mosaic <count> |
+//                 --sheet <png>] [url]
+// headless draws the given number of frames with no window and no pacing,
+// then prints the final frame hash (which frame that is depends on decode
+// thread timing, so it's no pixel-exact check); mosaic plays the url 'count'
+// times over in a grid
+int headless(int frames) {
+  if (!sdl.initOffscreen( DISP_W, DISP_H))
+    return 1;
+  init();
+  double invFreq = 1.0 / sdl.getPerfFreq();
+  Uint64 begin = sdl.getPerfCounter();
+  for (int i = 0; i < frames; i++) {
+    draw();
+    sdl.swap();
+  }
+  double secs = (double) (sdl.getPerfCounter() - begin) * invFreq;
+  term();
+  printf("%d frames in %f s (%f ms/frame)\n", frames, secs, frames ? secs * 1e3 / frames : 0.0);
+  printf("frame hash: %08x\n", sdl.frameHash());
+  sdl.takeScreenshot();
+  sdl.term();
+  return 0;
+}
+
+// batch decodes the whole file GOP-parallel (0 workers = one per core) and
+// prints the throughput
+int batch(int workers) {
+  BatchDecoder decoder(url, workers);
+  auto start = std::chrono::steady_clock::now();
+  uint64_t frames = decoder.run([](const AVFrame*) {
+  });
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("%llu frames in %f s (%.1f fps)\n", (unsigned long long) frames, secs, secs > 0.0 ? frames / secs : 0.0);
+  return frames ? 0 : 1;
+}
+
+// sheet saves a 5x5 contact sheet of keyframes from over the whole file
+int sheet(const char *png) {
+  Player player(url);
+  auto times = player.contactSheet(png, 5, 5, 192);
+  printf("%zu thumbnails to '%s'\n", times.size(), png);
+  return times.empty() ? 1 : 0;
+}
+
 int main(int argc, char *args[]) {
   setbuf( stdout, NULL);
 
-  if (!sdl.init( DISP_W, DISP_H, false, "go with the flow")) {
+  int arg = 1;
+  int headlessFrames = -1, batchWorkers = -1;
+  const char *sheetPng = nullptr;
+  if (argc > arg + 1 && std::string_view(args[arg]) == "--headless") {
+    headlessFrames = atoi(args[arg + 1]);
+    arg += 2;
+  } else if (argc > arg + 1 && std::string_view(args[arg]) == "--batch") {
+    batchWorkers = atoi(args[arg + 1]);
+    arg += 2;
+  } else if (argc > arg + 1 && std::string_view(args[arg]) == "--mosaic") {
+    mosaicCount = atoi(args[arg + 1]);
+    arg += 2;
+  } else if (argc > arg + 1 && std::string_view(args[arg]) == "--sheet") {
+    sheetPng = args[arg + 1];
+    arg += 2;
+  }
+  if (argc > arg)
+    url = args[arg];
+  if (headlessFrames >= 0)
+    return headless(headlessFrames);
+  if (batchWorkers >= 0)
+    return batch(batchWorkers);
+  if (sheetPng)
+    return sheet(sheetPng);
+
+  if (!sdl.initRenderer( WIN_W, WIN_H, DISP_W, DISP_H, false, "go with the flow")) {
     return 0;
   }
 
-  double drawTimeInSecs = 0.0;
-  Uint32 drawCount = 0.0;
-  double invFreq = 1.0 / sdl.getPerfFreq();
-
-  auto start = sdl.getTicks();
-  auto last = start;
   init();
-
-  while (true) {
-    auto now = sdl.getTicks();
-    auto elapsed = now - last;
-    if (sdl.keyDown(SDLK_ESCAPE))
-      break;
-    if (elapsed >= 20) {
-      sdl.pump();
-      step();
-      last = (now / 20) * 20;
-    }
-    Uint64 beginCount = sdl.getPerfCounter();
+  Loop loop(50.0, 60.0);
+  loop.run([]() {
+    sdl.pump();
+    if (sdl.quit || sdl.keyDown(SDLK_ESCAPE))
+      return false;
+    step();
+    return true;
+  }, [](float alpha) {
     draw();
-    drawCount++;
     sdl.swap();
-    drawTimeInSecs += (double) (sdl.getPerfCounter() - beginCount) * invFreq;
-  }
+  });
   term();
-  if (drawCount)
-    printf("Average draw time: %f ms\n",
-           (float) ((drawTimeInSecs * 1e3) / (double) drawCount));
+  loop.report();
 
   sdl.term();
 
@@ -0,0 +1,73 @@
+#include "mapped.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace sdl2;
+
+bool MappedFile::map(const char *path, bool copyOnWrite) {
+  unmap();
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file != INVALID_HANDLE_VALUE) {
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+      mapping = CreateFileMappingA(file, nullptr, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
+      if (mapping) {
+        view = MapViewOfFile(mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+        if (view)
+          size = size_t(fileSize.QuadPart);
+      }
+    }
+    CloseHandle(file);
+  }
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd >= 0) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      int prot = copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ;
+      void *addr = mmap(nullptr, size_t(st.st_size), prot, MAP_PRIVATE, fd, 0);
+      if (addr != MAP_FAILED) {
+        view = addr;
+        size = size_t(st.st_size);
+      }
+    }
+    close(fd);
+  }
+#endif
+  if (!view)
+    unmap();
+  return view != nullptr;
+}
+
+void MappedFile::unmap() {
+  if (view) {
+#ifdef _WIN32
+    UnmapViewOfFile(view);
+#else
+    munmap(view, size);
+#endif
+    view = nullptr;
+  }
+#ifdef _WIN32
+  if (mapping) {
+    CloseHandle(mapping);
+    mapping = nullptr;
+  }
+#endif
+  size = 0;
+}
+
+void MappedFile::sequential() {
+#ifndef _WIN32
+  if (view)
+    madvise(view, size, MADV_SEQUENTIAL);
+#endif
+}
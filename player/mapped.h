@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+
+namespace sdl2 {
+
+// A whole file mapped into memory, read-only or copy-on-write (writes stay
+// private to the mapping, the file never changes). Empty files and anything
+// the OS won't map leave it unmapped.
+struct MappedFile {
+  void *view = nullptr;
+  size_t size = 0;
+#ifdef _WIN32
+  void *mapping = nullptr;
+#endif
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator =(const MappedFile&) = delete;
+  ~MappedFile() {
+    unmap();
+  }
+  bool map(const char *path, bool copyOnWrite = false);
+  void unmap();
+  // hint for files read front to back
+  void sequential();
+  bool mapped() const {
+    return view != nullptr;
+  }
+};
+
+}
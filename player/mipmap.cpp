@@ -0,0 +1,124 @@
+#include "mipmap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <x86intrin.h>
+
+using namespace sdl2;
+
+static inline const Uint8* rowOf(const Pixels &pixels, int y) {
+  return &pixels.data[(pixels.inverted ? pixels.h - 1 - y : y) * pixels.p];
+}
+
+// averages the 2x2 block under each destination pixel in [x0, x1) x [y0, y1)
+static void downsample(const Pixels &src, Pixels &dst, int x0, int y0, int x1, int y1) {
+  int bytes = src.bpp / 8;
+  const __m128i two = _mm_set1_epi16(2);
+  const __m128i zero = _mm_setzero_si128();
+
+  for (int y = y0; y < y1; y++) {
+    const Uint8 *row0 = rowOf(src, std::min(2 * y, src.h - 1));
+    const Uint8 *row1 = rowOf(src, std::min(2 * y + 1, src.h - 1));
+    Uint8 *out = &dst.data[y * dst.p];
+    int x = x0;
+    if (bytes == 4 && src.w >= 2) {
+      for (; x + 4 <= x1; x += 4) {
+        __m128i a0 = _mm_loadu_si128((const __m128i*) &row0[x * 8]);
+        __m128i a1 = _mm_loadu_si128((const __m128i*) &row0[x * 8 + 16]);
+        __m128i b0 = _mm_loadu_si128((const __m128i*) &row1[x * 8]);
+        __m128i b1 = _mm_loadu_si128((const __m128i*) &row1[x * 8 + 16]);
+        // vertical sums in 16 bits, two pixels per register
+        __m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+        __m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+        __m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+        __m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+        // horizontal pairs
+        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+        __m128i hi = _mm_add_epi16(_mm_unpacklo_epi64(s2, s3), _mm_unpackhi_epi64(s2, s3));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+        _mm_storeu_si128((__m128i*) &out[x * 4], _mm_packus_epi16(lo, hi));
+      }
+    }
+    for (; x < x1; x++) {
+      int xa = std::min(2 * x, src.w - 1) * bytes;
+      int xb = std::min(2 * x + 1, src.w - 1) * bytes;
+      Uint8 *pixel = &out[x * 4];
+      for (int c = 0; c < 3; c++)
+        pixel[c] = Uint8((row0[xa + c] + row0[xb + c] + row1[xa + c] + row1[xb + c] + 2) >> 2);
+      pixel[3] = bytes == 4 ? Uint8((row0[xa + 3] + row0[xb + 3] + row1[xa + 3] + row1[xb + 3] + 2) >> 2) : 255;
+    }
+  }
+}
+
+bool Mipmap::build(const Pixels &source) {
+  levels.clear();
+  if (!source.hasData() || (source.bpp != 24 && source.bpp != 32))
+    return false;
+
+  Level base;
+  base.pixels = source;
+  levels.push_back(std::move(base));
+
+  int w = source.w, h = source.h;
+  while (w > 1 || h > 1) {
+    w = std::max(w / 2, 1);
+    h = std::max(h / 2, 1);
+    Level level;
+    level.buffer = SurfacePool::shared().acquire(w, h, 32);
+    if (!level.buffer.hasData()) {
+      levels.clear();
+      return false;
+    }
+    level.pixels = level.buffer.pixels;
+    levels.push_back(std::move(level));
+  }
+  for (int i = 1; i < numLevels(); i++)
+    downsample(levels[i - 1].pixels, levels[i].pixels, 0, 0, levels[i].pixels.w, levels[i].pixels.h);
+  return true;
+}
+
+void Mipmap::update(const Rect &dirty) {
+  if (levels.empty())
+    return;
+  int x0 = std::max(dirty.x, 0), y0 = std::max(dirty.y, 0);
+  int x1 = std::min(dirty.x + dirty.w, levels[0].pixels.w);
+  int y1 = std::min(dirty.y + dirty.h, levels[0].pixels.h);
+  for (int i = 1; i < numLevels() && x0 < x1 && y0 < y1; i++) {
+    Pixels &dst = levels[i].pixels;
+    x0 = std::min(x0 / 2, dst.w - 1);
+    y0 = std::min(y0 / 2, dst.h - 1);
+    x1 = std::min((x1 + 1) / 2, dst.w);
+    y1 = std::min((y1 + 1) / 2, dst.h);
+    downsample(levels[i - 1].pixels, dst, x0, y0, x1, y1);
+  }
+}
+
+float Mipmap::lod(float dudx, float dvdx, float dudy, float dvdy) const {
+  if (levels.empty())
+    return 0.0f;
+  float w = float(levels[0].pixels.w), h = float(levels[0].pixels.h);
+  float x = dudx * w, y = dvdx * h;
+  float s = dudy * w, t = dvdy * h;
+  float rho = std::max(x * x + y * y, s * s + t * t);
+  return rho > 0.0f ? 0.5f * log2f(rho) : 0.0f;
+}
+
+Pixel32 Mipmap::sample(float u, float v, float lod, Filter filter, bool clamped) {
+  if (levels.empty())
+    return Pixel32(0, 0, 0, 0);
+  lod = std::clamp(lod, 0.0f, float(numLevels() - 1));
+  if (filter == Bilinear)
+    return levels[int(lod + 0.5f)].pixels.sample(u, v, clamped);
+
+  int l0 = int(lod);
+  float t = lod - float(l0);
+  Pixel32 a = levels[l0].pixels.sample(u, v, clamped);
+  if (t <= 0.0f || l0 + 1 >= numLevels())
+    return a;
+  Pixel32 b = levels[l0 + 1].pixels.sample(u, v, clamped);
+  auto mix = [t](Uint8 x, Uint8 y) {
+    return Uint8(float(x) + (float(y) - float(x)) * t + 0.5f);
+  };
+  return Pixel32(mix(a.r, b.r), mix(a.g, b.g), mix(a.b, b.b), mix(a.a, b.a));
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "mysdl2.h"
+#include "surfaces.h"
+
+#include <vector>
+
+namespace sdl2 {
+
+// Mip chain over a Pixels source. Level 0 is the source itself (not copied,
+// so it has to outlive the chain), levels 1.. are 32-bit BGRA halved with a
+// 2x2 box filter down to 1x1, odd last rows/columns dropping out. Level
+// buffers come from the shared SurfacePool.
+struct Mipmap {
+  enum Filter {
+    Bilinear,  // bilinear within the nearest level
+    Trilinear  // bilinear in the two nearest levels, blended
+  };
+
+  struct Level {
+    PooledSurface buffer;
+    Pixels pixels;
+  };
+
+  std::vector<Level> levels;
+
+  Mipmap() = default;
+  Mipmap(const Pixels &source) {
+    build(source);
+  }
+
+  bool build(const Pixels &source);
+  // rebuilds only what a change to 'dirty' (level 0 pixels) touches
+  void update(const Rect &dirty);
+
+  int numLevels() const {
+    return int(levels.size());
+  }
+  Pixels& level(int i) {
+    return levels[i].pixels;
+  }
+
+  // level of detail for a footprint of the given uv derivatives
+  float lod(float dudx, float dvdx, float dudy, float dvdy) const;
+
+  Pixel32 sample(float u, float v, float lod, Filter filter = Trilinear, bool clamped = true);
+  Pixel32 sample(float u, float v, float dudx, float dvdx, float dudy, float dvdy, Filter filter = Trilinear,
+                 bool clamped = true) {
+    return sample(u, v, lod(dudx, dvdx, dudy, dvdy), filter, clamped);
+  }
+};
+
+}
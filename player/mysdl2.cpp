@@ -24,7 +24,7 @@ static inline vec4 toVec4(const Pixel32 &pixel) {
   v[0] = float(pixel.r);
   v[1] = float(pixel.g);
   v[2] = float(pixel.b);
-  v[2] = float(pixel.a);
+  v[3] = float(pixel.a);
   return v;
 }
 
@@ -77,6 +77,7 @@ Pixel32* Pixels::get32(int x, int y) {
     return nullptr;
   if (x < 0 || x >= w || y < 0 || y >= h)
     return nullptr;
+  y = inverted ? h - 1 - y : y;
   return (Pixel32*) &data[y * p + (x * 4)];
 }
 
@@ -85,6 +86,7 @@ Pixel24* Pixels::get24(int x, int y) {
     return nullptr;
   if (x < 0 || x >= w || y < 0 || y >= h)
     return nullptr;
+  y = inverted ? h - 1 - y : y;
   return (Pixel24*) &data[y * p + (x * 3)];
 }
 
@@ -219,7 +221,7 @@ void Pixels::flip() {
 }
 
 Bitmap::Bitmap(int w, int h, int d, std::string name) {
-  surf = SDL_CreateRGBSurface(0, w, h, d, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000);
+  surf = SDL_CreateRGBSurface(0, w, h, d, 0x00ff0000, 0x0000ff00, 0x000000ff, d == 32 ? 0xff000000 : 0);
   if (surf)
     source = std::move(name);
 }
@@ -313,6 +315,91 @@ Bitmap::~Bitmap() {
   }
 }
 
+static inline Uint16 readU16(const Uint8 *bytes) {
+  return Uint16(bytes[0] | (bytes[1] << 8));
+}
+
+static inline Uint32 readU32(const Uint8 *bytes) {
+  return Uint32(bytes[0]) | (Uint32(bytes[1]) << 8) | (Uint32(bytes[2]) << 16) | (Uint32(bytes[3]) << 24);
+}
+
+// validates the headers and points 'pixels' at the pixel array, returns false
+// for anything Pixels can't address directly
+static bool viewBMP(const Uint8 *bytes, size_t size, Pixels &pixels) {
+  constexpr Uint32 BI_RGB_ = 0, BI_BITFIELDS_ = 3;
+  if (size < 54 || bytes[0] != 'B' || bytes[1] != 'M')
+    return false;
+  Uint32 offBits = readU32(&bytes[10]);
+  Uint32 infoSize = readU32(&bytes[14]);
+  Sint32 w = Sint32(readU32(&bytes[18]));
+  Sint32 h = Sint32(readU32(&bytes[22]));
+  Uint16 planes = readU16(&bytes[26]);
+  Uint16 bpp = readU16(&bytes[28]);
+  Uint32 compression = readU32(&bytes[30]);
+
+  if (infoSize < 40 || planes != 1 || w <= 0 || h == 0 || h == INT32_MIN)
+    return false;
+  if (bpp == 24 && compression != BI_RGB_)
+    return false;
+  if (bpp == 32) {
+    if (compression == BI_BITFIELDS_) {
+      // masks follow a 40 byte header, or live inside a V3+ header
+      if (size < 66 || readU32(&bytes[54]) != 0x00ff0000 || readU32(&bytes[58]) != 0x0000ff00
+          || readU32(&bytes[62]) != 0x000000ff)
+        return false;
+    } else if (compression != BI_RGB_)
+      return false;
+  }
+  if (bpp != 24 && bpp != 32)
+    return false;
+
+  Uint64 pitch = ((Uint64(w) * bpp + 31) / 32) * 4;
+  Uint64 rows = h < 0 ? Uint64(-Sint64(h)) : Uint64(h);
+  if (pitch > INT32_MAX || rows > INT32_MAX || offBits > size || pitch * rows > size - offBits)
+    return false;
+
+  pixels.data = const_cast<Uint8*>(&bytes[offBits]);
+  pixels.w = w;
+  pixels.h = int(rows);
+  pixels.p = int(pitch);
+  pixels.bpp = bpp;
+  pixels.inverted = h > 0;
+  return true;
+}
+
+MappedBitmap::MappedBitmap(const char *bmpFile) {
+  source = bmpFile;
+  if (file.map(bmpFile, true) && viewBMP((const Uint8*) file.view, file.size, pixels))
+    return;
+
+  // not something we can view in place
+  file.unmap();
+  pixels = Pixels();
+  surf = SDL_LoadBMP(bmpFile);
+  if (!surf) {
+    printf("MappedBitmap::MappedBitmap - error: '%s'\n", SDL_GetError());
+    return;
+  }
+  if ( SDL_MUSTLOCK(surf))
+    SDL_LockSurface(surf);
+  pixels.data = (Uint8*) surf->pixels;
+  pixels.bpp = surf->format->BitsPerPixel;
+  pixels.w = surf->w;
+  pixels.h = surf->h;
+  pixels.p = surf->pitch;
+}
+
+MappedBitmap::~MappedBitmap() {
+  file.unmap();
+  if (surf) {
+    if ( SDL_MUSTLOCK(surf) && surf->locked)
+      SDL_UnlockSurface(surf);
+    SDL_FreeSurface(surf);
+    surf = nullptr;
+  }
+  pixels = Pixels();
+}
+
 Font::Font(std::string_view path, int size) {
   font = TTF_OpenFont(path.data(), size);
   for (char i = ' '; i <= '~'; i++) {
@@ -425,27 +512,173 @@ bool SDL::init(Uint32 w, Uint32 h, bool borderless, std::string_view title, bool
   printf(" * bpp...: %d\n", surf->format->BitsPerPixel);
   printf(" * format: %s\n\n", SDL_GetPixelFormatName(surf->format->format));
 
-  keys = SDL_GetKeyboardState(&numKeys);
-  for (int i = 0; i < SDL_NUM_SCANCODES; i++)
-    keyCounters[i] = 0;
+  resetInput();
 
   return true;
 }
 
-void SDL::pump() {
-  SDL_PumpEvents();
-  for (int i = 0; i < SDL_NUM_SCANCODES; i++)
-    keyCounters[i] = keys[i] ? keyCounters[i] + 1 : 0;
-  Uint32 mask = SDL_GetMouseState(&mouseX, &mouseY);
-  for (int i = 0; i < 8; i++) {
-    Uint32 bitMask = 1 << i;
-    if (mask & bitMask)
-      mouseCounters[i]++;
-    else
-      mouseCounters[i] = 0;
+bool SDL::initOffscreen(Uint32 w, Uint32 h, int bpp) {
+  if (bpp != 24 && bpp != 32) {
+    printf("offscreen surface must be 24 or 32 bpp\n");
+    return false;
+  }
+  if (SDL_Init( SDL_INIT_EVENTS) < 0) {
+    printf("could not initialize SDL: %s\n", SDL_GetError());
+    return false;
+  } else
+    printf("SDL initialized (offscreen)\n");
+
+  inited = true;
+  offscreen = true;
+
+  // XRGB: nothing drawn here writes alpha, so screenshots must not use it
+  surf = SDL_CreateRGBSurface(0, w, h, bpp, 0x00ff0000, 0x0000ff00, 0x000000ff, 0);
+  if (!surf) {
+    printf("could not create offscreen surface: %s\n", SDL_GetError());
+    return false;
+  }
+  printf("surface format: \n");
+  printf(" * w x h.: %d x %d\n", surf->w, surf->h);
+  printf(" * pitch.: %d\n", surf->pitch);
+  printf(" * bpp...: %d\n\n", surf->format->BitsPerPixel);
+
+  resetInput();
+
+  return true;
+}
+
+bool SDL::initRenderer(Uint32 winW, Uint32 winH, Uint32 texW, Uint32 texH, bool borderless, std::string_view title,
+                       bool software, bool vsync) {
+  if (SDL_Init( SDL_INIT_VIDEO) < 0) {
+    printf("could not initialize SDL: %s\n", SDL_GetError());
+    return false;
+  } else
+    printf("SDL initialized\n");
+
+  inited = true;
+
+  win = SDL_CreateWindow(title.data(), SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, winW, winH,
+                         SDL_WINDOW_SHOWN | (borderless ? SDL_WINDOW_BORDERLESS : 0));
+  if (!win) {
+    printf("could not create window: %s\n", SDL_GetError());
+    return false;
+  }
+
+  SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+  Uint32 flags = (software ? SDL_RENDERER_SOFTWARE : SDL_RENDERER_ACCELERATED) | (vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
+  renderer = SDL_CreateRenderer(win, -1, flags);
+  if (!renderer && !software)
+    renderer = SDL_CreateRenderer(win, -1, SDL_RENDERER_SOFTWARE);
+  if (!renderer) {
+    printf("could not create renderer: %s\n", SDL_GetError());
+    return false;
+  }
+
+  // stream in the window's own format where it's one Pixels and the BGR(A)
+  // scalers lay out the same way, byte for byte
+  textureFormat = SDL_GetWindowPixelFormat(win);
+  if (textureFormat != SDL_PIXELFORMAT_RGB888 && textureFormat != SDL_PIXELFORMAT_ARGB8888
+      && textureFormat != SDL_PIXELFORMAT_BGR24)
+    textureFormat = SDL_PIXELFORMAT_ARGB8888;
+  texture = SDL_CreateTexture(renderer, textureFormat, SDL_TEXTUREACCESS_STREAMING, texW, texH);
+  if (!texture) {
+    printf("could not create texture: %s\n", SDL_GetError());
+    return false;
   }
+  textureW = texW;
+  textureH = texH;
+
+  SDL_RendererInfo info;
+  if (SDL_GetRendererInfo(renderer, &info) == 0)
+    printf("renderer: %s\n", info.name);
+  printf("texture format: \n");
+  printf(" * w x h.: %d x %d (window %u x %u)\n", textureW, textureH, winW, winH);
+  printf(" * bpp...: %d\n", SDL_BYTESPERPIXEL(textureFormat) * 8);
+  printf(" * format: %s\n\n", SDL_GetPixelFormatName(textureFormat));
+
+  resetInput();
+
+  return true;
+}
+
+void SDL::resetInput() {
+  frame = 0;
+  memset(keyHeld, 0, sizeof(keyHeld));
+  memset(keyPressFrame, 0, sizeof(keyPressFrame));
+  memset(mousePressFrame, 0, sizeof(mousePressFrame));
+  mouseX = mouseY = 0;
+  mouseButtons = 0;
+  numEvents = 0;
+  droppedEvents = 0;
+  quit = false;
+}
+
+void SDL::pump() {
+  frame++;
+  numEvents = 0;
+
   SDL_Event e;
   while (SDL_PollEvent(&e)) {
+    InputEvent event;
+    switch (e.type) {
+      case SDL_KEYDOWN:
+      case SDL_KEYUP: {
+        Sint32 code = e.key.keysym.scancode;
+        if (e.key.repeat || code < 0 || code >= SDL_NUM_SCANCODES)
+          continue;
+        bool down = e.type == SDL_KEYDOWN;
+        if (down && !keyHeld[code])
+          keyPressFrame[code] = frame;
+        keyHeld[code] = down;
+        event.type = down ? InputEvent::KeyDown : InputEvent::KeyUp;
+        event.timestamp = e.key.timestamp;
+        event.code = code;
+        event.x = mouseX;
+        event.y = mouseY;
+        break;
+      }
+      case SDL_MOUSEBUTTONDOWN:
+      case SDL_MOUSEBUTTONUP: {
+        Sint32 code = Sint32(e.button.button) - 1;
+        if (code < 0 || code >= 8)
+          continue;
+        bool down = e.type == SDL_MOUSEBUTTONDOWN;
+        if (down && !(mouseButtons & (1u << code)))
+          mousePressFrame[code] = frame;
+        mouseButtons = down ? mouseButtons | (1u << code) : mouseButtons & ~(1u << code);
+        mouseX = e.button.x;
+        mouseY = e.button.y;
+        event.type = down ? InputEvent::MouseDown : InputEvent::MouseUp;
+        event.timestamp = e.button.timestamp;
+        event.code = code;
+        event.x = mouseX;
+        event.y = mouseY;
+        break;
+      }
+      case SDL_MOUSEMOTION:
+        mouseX = e.motion.x;
+        mouseY = e.motion.y;
+        event.type = InputEvent::MouseMotion;
+        event.timestamp = e.motion.timestamp;
+        event.x = mouseX;
+        event.y = mouseY;
+        break;
+      case SDL_MOUSEWHEEL:
+        event.type = InputEvent::MouseWheel;
+        event.timestamp = e.wheel.timestamp;
+        event.x = e.wheel.x;
+        event.y = e.wheel.y;
+        break;
+      case SDL_QUIT:
+        quit = true;
+        continue;
+      default:
+        continue;
+    }
+    if (numEvents < MaxEvents)
+      events[numEvents++] = event;
+    else
+      droppedEvents++;
   }
 }
 
@@ -463,6 +696,20 @@ double SDL::getPerfFreq() {
 
 void SDL::term() {
 
+  if (texture) {
+    SDL_DestroyTexture(texture);
+    texture = nullptr;
+    texturePixels = nullptr;
+  }
+  if (renderer) {
+    SDL_DestroyRenderer(renderer);
+    renderer = nullptr;
+  }
+  if (offscreen && surf) {
+    SDL_FreeSurface(surf);
+    surf = nullptr;
+    offscreen = false;
+  }
   if (win) {
     SDL_DestroyWindow(win);
     win = nullptr;
@@ -475,6 +722,18 @@ void SDL::term() {
 
 Pixels SDL::lock() {
   Pixels pixels;
+  if (texture) {
+    if (!texturePixels && SDL_LockTexture(texture, nullptr, &texturePixels, &texturePitch) < 0) {
+      texturePixels = nullptr;
+      return pixels;
+    }
+    pixels.data = (Uint8*) texturePixels;
+    pixels.bpp = SDL_BYTESPERPIXEL(textureFormat) * 8;
+    pixels.w = textureW;
+    pixels.h = textureH;
+    pixels.p = texturePitch;
+    return pixels;
+  }
   if ( SDL_MUSTLOCK(surf) && !surf->locked)
     SDL_LockSurface(surf);
 
@@ -486,7 +745,20 @@ Pixels SDL::lock() {
   return pixels;
 }
 void SDL::swap() {
-  if (ctx) {
+  if (renderer) {
+    if (texturePixels) {
+      SDL_UnlockTexture(texture);
+      texturePixels = nullptr;
+    }
+    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+    // the backbuffer is undefined after presenting
+    if (screenshotPending)
+      readScreenshot();
+    SDL_RenderPresent(renderer);
+  } else if (offscreen) {
+    if ( SDL_MUSTLOCK(surf) && surf->locked)
+      SDL_UnlockSurface(surf);
+  } else if (ctx) {
     SDL_GL_SwapWindow(win);
   } else {
     if ( SDL_MUSTLOCK(surf) && surf->locked)
@@ -497,22 +769,70 @@ void SDL::swap() {
 }
 
 bool SDL::keyDown(Sint32 key) {
-  return keys[SDL_GetScancodeFromKey(key)] > 0;
+  SDL_Scancode code = SDL_GetScancodeFromKey(key);
+  return code > 0 && code < SDL_NUM_SCANCODES && keyHeld[code];
 }
 
+// pressed during the last pump(), even if already released again
 bool SDL::keyPress(Sint32 key) {
-  return keyCounters[SDL_GetScancodeFromKey(key)] == 1;
+  SDL_Scancode code = SDL_GetScancodeFromKey(key);
+  return code > 0 && code < SDL_NUM_SCANCODES && frame && keyPressFrame[code] == frame;
 }
 
 bool SDL::mouseKeyDown(Uint8 key) {
-  return mouseCounters[key & 0x08] > 0;
+  return key < 8 && (mouseButtons & (1u << key));
 }
 bool SDL::mouseKeyPress(Uint8 key) {
-  return mouseCounters[key & 0x08] == 1;
+  return key < 8 && frame && mousePressFrame[key] == frame;
 }
 
 void SDL::takeScreenshot() {
+  if (renderer) {
+    screenshotPending = true;
+    return;
+  }
   std::string fileName = "screenshot" + std::to_string(screenshot) + ".png";
   IMG_SavePNG(surf, fileName.c_str());
   screenshot++;
 }
+
+// the frame just rendered, at window resolution; swap() calls this between
+// RenderCopy and RenderPresent
+void SDL::readScreenshot() {
+  screenshotPending = false;
+  std::string fileName = "screenshot" + std::to_string(screenshot) + ".png";
+  int w = 0, h = 0;
+  SDL_GetRendererOutputSize(renderer, &w, &h);
+  SDL_Surface *shot = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_ARGB8888);
+  if (shot) {
+    if (SDL_RenderReadPixels(renderer, nullptr, SDL_PIXELFORMAT_ARGB8888, shot->pixels, shot->pitch) == 0)
+      IMG_SavePNG(shot, fileName.c_str());
+    SDL_FreeSurface(shot);
+  }
+  screenshot++;
+}
+
+// FNV-1a over the visible bytes of every row (pitch padding is skipped), for
+// comparing headless runs; only repeatable where drawing is deterministic
+Uint32 SDL::frameHash() {
+  if (!surf)
+    return 0;
+  bool unlock = false;
+  if ( SDL_MUSTLOCK(surf) && !surf->locked) {
+    unlock = true;
+    SDL_LockSurface(surf);
+  }
+  Uint32 hash = 2166136261u;
+  const Uint8 *data = (const Uint8*) surf->pixels;
+  int rowBytes = surf->w * surf->format->BytesPerPixel;
+  for (int y = 0; y < surf->h; y++) {
+    const Uint8 *row = &data[y * surf->pitch];
+    for (int i = 0; i < rowBytes; i++) {
+      hash ^= row[i];
+      hash *= 16777619u;
+    }
+  }
+  if (unlock)
+    SDL_UnlockSurface(surf);
+  return hash;
+}
@@ -10,6 +10,8 @@
 #include <string>
 #include <vector>
 
+#include "mapped.h"
+
 namespace sdl2 {
 
 #pragma pack( push, 1 )
@@ -125,6 +127,33 @@ struct Bitmap {
   void blit(Bitmap &dstBmp, const Rect *srcRect = nullptr, Rect *dstRect = nullptr);
 };
 
+// Read-only BMP asset mapped straight from disk: 'pixels' points into the
+// file mapping (copy-on-write), bottom-up DIBs are flagged as inverted.
+// Formats that can't be viewed in place (RLE, palettes, 16-bit, odd masks)
+// fall back to SDL_LoadBMP.
+struct MappedBitmap {
+  std::string source;
+  Pixels pixels;
+  SDL_Surface *surf = nullptr;  // only set for the SDL fallback
+  MappedFile file;
+  MappedBitmap(const char *bmpFile);
+  MappedBitmap(const MappedBitmap&) = delete;
+  MappedBitmap& operator =(const MappedBitmap&) = delete;
+  ~MappedBitmap();
+  bool mapped() const {
+    return file.mapped();
+  }
+  int width() const {
+    return pixels.w;
+  }
+  int height() const {
+    return pixels.h;
+  }
+  int depth() const {
+    return pixels.bpp;
+  }
+};
+
 struct Font {
   TTF_Font *font = nullptr;
   std::vector<SDL_Surface*> glyphs;
@@ -134,20 +163,60 @@ struct Font {
   ~Font();
 };
 
+struct InputEvent {
+  enum Type : Uint8 {
+    KeyDown,
+    KeyUp,
+    MouseDown,
+    MouseUp,
+    MouseMotion,
+    MouseWheel
+  };
+  Type type = KeyDown;
+  Uint32 timestamp = 0;  // SDL ticks (ms)
+  Sint32 code = 0;  // scancode, or button index (0 = left)
+  Sint32 x = 0, y = 0;  // mouse position, or wheel delta
+};
+
 struct SDL {
+  static constexpr int MaxEvents = 256;
 
   bool inited = false;
   SDL_Window *win = nullptr;
   SDL_Surface *surf = nullptr;
   SDL_GLContext ctx = nullptr;
-  const Uint8 *keys = nullptr;
-  Sint32 numKeys = 0;
-  Uint32 keyCounters[SDL_NUM_SCANCODES];
-  Sint32 mouseX, mouseY;
-  Uint32 mouseCounters[8];
+  SDL_Renderer *renderer = nullptr;
+  SDL_Texture *texture = nullptr;
+  Uint32 textureFormat = SDL_PIXELFORMAT_UNKNOWN;
+  int textureW = 0, textureH = 0;
+  void *texturePixels = nullptr;  // set while the texture is locked
+  int texturePitch = 0;
+
+  // input is only touched by events: pump() updates the keys and buttons that
+  // changed and lists this frame's events, overflow beyond MaxEvents still
+  // updates state but isn't listed
+  Uint32 frame = 0;
+  Uint8 keyHeld[SDL_NUM_SCANCODES];
+  Uint32 keyPressFrame[SDL_NUM_SCANCODES];
+  Sint32 mouseX = 0, mouseY = 0;
+  Uint32 mouseButtons = 0;
+  Uint32 mousePressFrame[8];
+  InputEvent events[MaxEvents];
+  int numEvents = 0;
+  Uint32 droppedEvents = 0;
+  bool quit = false;
+
   Uint32 screenshot = 0;
+  bool screenshotPending = false;  // renderer only, taken by the next swap()
+  bool offscreen = false;
 
   bool init(Uint32 w, Uint32 h, bool borderless = true, std::string_view title = "demo", bool withOpenGL = false);
+  // no window: lock() hands out a memory surface and swap() returns at once
+  bool initOffscreen(Uint32 w, Uint32 h, int bpp = 32);
+  // window of winW x winH presenting a texW x texH streaming texture through
+  // SDL_Renderer, scaled by the backend; lock() maps the texture, so every
+  // frame has to be drawn in full
+  bool initRenderer(Uint32 winW, Uint32 winH, Uint32 texW, Uint32 texH, bool borderless = true, std::string_view title = "demo", bool software = false, bool vsync = false);
   void pump();
   void swap();
   void term();
@@ -157,9 +226,14 @@ struct SDL {
   Pixels lock();
   bool keyDown(Sint32 key);
   bool keyPress(Sint32 key);
-  bool mouseKeyDown(Uint8 key);
+  bool mouseKeyDown(Uint8 key);  // 0 = left, 1 = middle, 2 = right...
   bool mouseKeyPress(Uint8 key);
+  void resetInput();
+  // saves screenshot<n>.png: the surface right away, or with a renderer the
+  // next frame swap() renders, read back before it's presented
   void takeScreenshot();
+  void readScreenshot();
+  Uint32 frameHash();
 };
 
 }
@@ -2,27 +2,121 @@
 
 #include <cstdio>
 #include <cstdint>
+#include <cstring>
+#include <cfloat>
 
 #include <string>
 #include <string_view>
 #include <chrono>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <functional>
 
 extern "C" {
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 #include <libswscale/swscale.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
 }
 
+#include "mysdl2.h"
+#include "keyindex.h"
+#include "gopcache.h"
+#include "source.h"
+#include "scale.h"
+
+// Blocking FIFO of at most 'capacity' items. close() wakes every waiter,
+// after which push() fails and pop() hands out what's left, then fails.
+template<typename T>
+struct BoundedQueue {
+  std::mutex mutex;
+  std::condition_variable notEmpty, notFull;
+  std::deque<T> items;
+  size_t capacity = 1;
+  bool closed = false;
+
+  BoundedQueue(size_t capacity = 1)
+      :
+      capacity(capacity) {
+  }
+
+  bool push(T item) {
+    std::unique_lock<std::mutex> lk(mutex);
+    notFull.wait(lk, [this]() {
+      return closed || items.size() < capacity;
+    });
+    if (closed)
+      return false;
+    items.push_back(std::move(item));
+    notEmpty.notify_one();
+    return true;
+  }
+
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> lk(mutex);
+    notEmpty.wait(lk, [this]() {
+      return closed || !items.empty();
+    });
+    if (items.empty())
+      return false;
+    item = std::move(items.front());
+    items.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lg(mutex);
+    closed = true;
+    notEmpty.notify_all();
+    notFull.notify_all();
+  }
+
+  void reopen() {
+    std::lock_guard<std::mutex> lg(mutex);
+    closed = false;
+  }
+
+  size_t size() {
+    std::lock_guard<std::mutex> lg(mutex);
+    return items.size();
+  }
+};
+
+// Decoding runs on two threads once started: the demuxer reads video packets
+// into 'packets', the decoder turns them into frames (recycled through a
+// pool) in 'frames', and play() pops the next one. A null packet marks the
+// end of the stream, the decoder then drains the codec and closes 'frames'.
 struct Player {
+  // how the codec spreads work over cores; Auto lets it pick frame and/or
+  // slice threading, whatever the codec supports
+  enum Threading {
+    AutoThreads,
+    FrameThreads,  // one frame per thread, adds thread count - 1 frames of delay
+    SliceThreads,  // one frame at a time, split in slices, no extra delay
+    NoThreads
+  };
+
+  std::unique_ptr<Source> source;  // custom input, see source.h
   AVFormatContext *fmtCtx = nullptr;
   AVCodecContext *codecCtx = nullptr;
   struct SwsContext *swsCtx = nullptr;
   std::string url = "";
   uint32_t w = 0, h = 0;
+  AVPixelFormat outFormat = AV_PIX_FMT_RGB24;  // of 'buffer'
   uint8_t *buffer = nullptr;
 
+  // swsCtx is rebuilt whenever source or target change, see prepareScaler()
+  int scaleFlags = SWS_BICUBIC;
+  int scaleThreads = 0;  // swscale slice threads, 0 = one per core
+  int swsKey[7] = { };
+
   AVFrame *frame = nullptr;  //av_frame_alloc();
   AVFrame *rgbFrame = nullptr;  //av_frame_alloc();
   int vidStream = -1;
@@ -30,18 +124,120 @@ struct Player {
   double fps = 0.0;
   double duration = 0.0;
   double elapsed = 0.0;
-  double avgProcessTimeInMs = 0.0;
+  // Reading and decoding one frame, as before the pipeline: now the decode
+  // thread's time inside the codec per frame out, smoothed. How long play()
+  // waited on the pipeline for a frame is 'avgWaitMs', only reported.
+  std::atomic<double> avgProcessTimeInMs { 0.0 };
+  double avgWaitMs = 0.0;
+  // decoder throughput, counting only time spent inside the codec
+  std::atomic<uint64_t> decodedFrames { 0 }, decodeBusyNs { 0 };
+  uint64_t lastFrameBusyNs = 0;  // decode thread only
+
+  // queue depths, change before the first play()
+  size_t maxPackets = 256;
+  size_t maxFrames = 8;
+  BoundedQueue<AVPacket*> packets;
+  BoundedQueue<AVFrame*> frames;
+  std::mutex poolMutex;
+  std::vector<AVFrame*> framePool;
+  std::thread demuxer, decoder;
+  std::atomic<bool> stopping { false };
+  bool started = false;
+
+  // keyframes for exact seeks: the container's index if it has one, else a
+  // sidecar next to a local file, else scanned in the background (and then
+  // saved as the sidecar)
+  std::mutex indexMutex;
+  KeyframeIndex index;
+
+  // Presentation clock for present(): 'clockStart' (seconds of pts) is due
+  // at 'clockBase'. Every frame is scheduled from these two, so sleeping
+  // late never adds up; the clock is only rebased on the first frame, after
+  // seeks and when pts jump.
+  std::chrono::steady_clock::time_point clockBase;
+  double clockStart = -1.0;
+  double skipAfterMs = 250.0;  // this far behind, the decoder drops non-reference frames
+  double resyncAfterMs = 1000.0;  // this far off, rebase instead of chasing
+  uint64_t framesShown = 0, framesLate = 0, framesDropped = 0;
+  std::atomic<bool> skipNonRef { false };
+  std::atomic<uint64_t> packetsSkipping { 0 };
+  std::thread indexer;
+  std::atomic<bool> closing { false };
+
+  // decoded GOPs for step() and reverse playback, see enableCache()
+  std::unique_ptr<GopCache> gopCache;
+  bool stepped = false;  // 'frame' came from the cache, play() resumes from it
+
+  // for thumbnails, apart from swsCtx so previews don't thrash playback's
+  struct SwsContext *thumbSws = nullptr;
+
+  // Quality governor. With the output at most half the source size each
+  // way, start() reopens the codec at 'lowres' (where the codec has it).
+  // Every 'governWindow' frames play() weighs avgProcessTimeInMs, the
+  // decoder's own cost per frame, against the frame period (waiting on a
+  // slow source isn't the decoder's to fix): past 'degradeAt' it
+  // drops one level, under 'restoreAt' for 'restoreWindows' windows running
+  // it gets one back. Levels: 1 no loop filter on non-reference frames,
+  // 2 on any, 3 also no IDCT on non-reference frames, 4 also no
+  // non-reference frames at all.
+  bool adaptive = true;
+  const AVCodec *codec = nullptr;
+  Threading threading = AutoThreads;
+  int threads = 0;
+  int lowres = 0;
+  int governWindow = 25, restoreWindows = 4, maxQualityDrop = 4;
+  double degradeAt = 0.9, restoreAt = 0.6;
+  std::atomic<int> qualityDrop { 0 };
+  int governFrames = 0, calmWindows = 0;
+  uint64_t qualityChanges = 0;
 
   int frameSize() {
-    return av_image_get_buffer_size(AV_PIX_FMT_RGB24, w, h, 1);
+    return av_image_get_buffer_size(outFormat, w, h, 1);
   }
 
-  Player(std::string_view url_, uint32_t w_ = 0, uint32_t h_ = 0)
+  // 'threads' = 0 sizes the decoder's thread pool to the machine
+  Player(std::string_view url_, uint32_t w_ = 0, uint32_t h_ = 0,
+         AVPixelFormat outFormat_ = AV_PIX_FMT_RGB24,
+         Threading threading_ = AutoThreads, int threads_ = 0)
       :
       url(url_),
       w(w_),
-      h(h_) {
-    if (avformat_open_input(&fmtCtx, url.c_str(), nullptr, nullptr) != 0) {
+      h(h_),
+      outFormat(outFormat_),
+      threading(threading_),
+      threads(threads_) {
+    open();
+  }
+
+  // reads through 'source_' instead of FFmpeg's own protocols, 'name' only
+  // labels it and hints the format
+  Player(std::unique_ptr<Source> source_, std::string_view name,
+         uint32_t w_ = 0, uint32_t h_ = 0,
+         AVPixelFormat outFormat_ = AV_PIX_FMT_RGB24,
+         Threading threading_ = AutoThreads, int threads_ = 0)
+      :
+      source(std::move(source_)),
+      url(name),
+      w(w_),
+      h(h_),
+      outFormat(outFormat_),
+      threading(threading_),
+      threads(threads_) {
+    open();
+  }
+
+  void open() {
+    // lets stop() break out of a blocking network read
+    fmtCtx = avformat_alloc_context();
+    fmtCtx->interrupt_callback.callback = [](void *opaque) {
+      return ((Player*) opaque)->stopping.load() ? 1 : 0;
+    };
+    fmtCtx->interrupt_callback.opaque = this;
+    int resp =
+        source ?
+            source->open(&fmtCtx, url.c_str()) :
+            avformat_open_input(&fmtCtx, url.c_str(), nullptr, nullptr);
+    if (resp != 0) {
       printf("AVPlayer failed to open '%s'\n", url.data());
       w = h = 0;
       url = "";
@@ -64,29 +260,130 @@ struct Player {
     printf(" - duration is %lf seconds (~%zu minutes)\n", duration,
            size_t(duration / 60.0));
 
-    codecCtx = avcodec_alloc_context3(nullptr);
-    avcodec_parameters_to_context(codecCtx,
-                                  fmtCtx->streams[vidStream]->codecpar);
-    printf(" - %d x %d\n", codecCtx->width, codecCtx->height);
-
-    const AVCodec *codec = avcodec_find_decoder(codecCtx->codec_id);
-    avcodec_open2(codecCtx, codec, nullptr);
+    AVCodecParameters *par = fmtCtx->streams[vidStream]->codecpar;
+    printf(" - %d x %d\n", par->width, par->height);
+    codec = avcodec_find_decoder(par->codec_id);
+    openCodec(0);
     printf(" - codec '%s'\n", codec->name);
+    printf(" - %d decoder threads (%s)\n", codecCtx->thread_count,
+           codecCtx->active_thread_type & FF_THREAD_FRAME ? "frame" :
+           codecCtx->active_thread_type & FF_THREAD_SLICE ? "slice" : "none");
 
     if (!w)
-      w = codecCtx->width;
+      w = par->width;
     if (!h)
-      h = codecCtx->height;
+      h = par->height;
 
-    int nbytes = av_image_get_buffer_size(AV_PIX_FMT_RGB24, w, h, 1);
-    buffer = (uint8_t*) av_malloc(nbytes);
-    swsCtx = sws_getContext(codecCtx->width, codecCtx->height,
-                            codecCtx->pix_fmt, w, h, AV_PIX_FMT_RGB24,
-                            SWS_BICUBIC, nullptr, nullptr, nullptr);
+    buffer = (uint8_t*) av_malloc(frameSize());
     frame = av_frame_alloc();
     rgbFrame = av_frame_alloc();
     av_image_fill_arrays(rgbFrame->data, rgbFrame->linesize, buffer,
-                         AV_PIX_FMT_RGB24, w, h, 1);
+                         outFormat, w, h, 1);
+
+    buildIndex();
+  }
+
+  // (re)opens codecCtx, lowres can't change on an open codec
+  void openCodec(int lowres_) {
+    if (codecCtx)
+      avcodec_free_context(&codecCtx);
+    codecCtx = avcodec_alloc_context3(nullptr);
+    avcodec_parameters_to_context(codecCtx,
+                                  fmtCtx->streams[vidStream]->codecpar);
+    switch (threading) {
+      case NoThreads:
+        codecCtx->thread_count = 1;
+        break;
+      case FrameThreads:
+        codecCtx->thread_type = FF_THREAD_FRAME;
+        codecCtx->thread_count = threads;
+        break;
+      case SliceThreads:
+        codecCtx->thread_type = FF_THREAD_SLICE;
+        codecCtx->thread_count = threads;
+        break;
+      default:
+        codecCtx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+        codecCtx->thread_count = threads;
+    }
+    lowres = lowres_;
+    codecCtx->lowres = lowres;
+    avcodec_open2(codecCtx, codec, nullptr);
+  }
+
+  // the most the source can be halved and still cover w x h
+  int lowresFor() const {
+    AVCodecParameters *par = fmtCtx->streams[vidStream]->codecpar;
+    int level = 0;
+    while (level < codec->max_lowres && (par->width >> (level + 1)) >= int(w)
+        && (par->height >> (level + 1)) >= int(h))
+      level++;
+    return level;
+  }
+
+  // reopens the codec if the output size calls for another lowres, then
+  // decodes back to where playback was
+  void adaptLowres() {
+    int want = adaptive ? lowresFor() : 0;
+    if (want == lowres)
+      return;
+    stop();
+    openCodec(want);
+    printf(" - lowres %d (%d x %d decoded)\n", lowres, codecCtx->width,
+           codecCtx->height);
+    if (frame->data[0])
+      seek(elapsed);
+  }
+
+  // Sidecar first, then the container's index where it needs no fixing;
+  // anything that takes reading (a full scan, or keyframe pts when the
+  // stream reorders) goes to the indexer thread and the sidecar, and only
+  // for local input. seek() copes without an index meanwhile.
+  void buildIndex() {
+    int64_t size = 0, mtime = 0;
+    bool file = KeyframeIndex::stamp(url, size, mtime);
+    std::string sidecar = file ? url + ".keyframes" : "";
+    if (file && index.load(sidecar, size, mtime)) {
+      printf(" - %zu keyframes from '%s'\n", index.pts.size(),
+             sidecar.c_str());
+      return;
+    }
+    KeyframeIndex listed;
+    if (listed.fromContainer(fmtCtx, vidStream) && !listed.reorders) {
+      printf(" - %zu keyframes in the container index\n", listed.pts.size());
+      index = std::move(listed);
+      return;
+    }
+    if (!file && !(source && source->local))
+      return;  // remote, seeks rely on the demuxer alone
+    std::unique_ptr<Source> reader = source ? source->reopen() : nullptr;
+    indexer = std::thread(
+        [this, sidecar, size, mtime, listed = std::move(listed),
+         reader = std::move(reader)]() mutable {
+      // closing breaks off a read stalled on the network too
+      AVFormatContext *ctx = avformat_alloc_context();
+      ctx->interrupt_callback.callback = [](void *opaque) {
+        return ((Player*) opaque)->closing.load() ? 1 : 0;
+      };
+      ctx->interrupt_callback.opaque = this;
+      int resp =
+          reader ?
+              reader->open(&ctx, url.c_str()) :
+              avformat_open_input(&ctx, url.c_str(), nullptr, nullptr);
+      if (resp != 0)
+        return;
+      KeyframeIndex scanned = std::move(listed);
+      bool ok = scanned.empty() ?
+          scanned.scan(ctx, vidStream, &closing) :
+          scanned.keyPts(ctx, vidStream, &closing);
+      if (ok) {
+        if (!sidecar.empty())
+          scanned.save(sidecar, size, mtime);
+        std::lock_guard<std::mutex> lg(indexMutex);
+        index = std::move(scanned);
+      }
+      avformat_close_input(&ctx);
+    });
   }
 
   void resize(uint32_t w_, uint32_t h_) {
@@ -104,89 +401,651 @@ struct Player {
 
     if (buffer)
       av_free(buffer);
-    int nbytes = av_image_get_buffer_size(AV_PIX_FMT_RGB24, w, h, 1);
-    buffer = (uint8_t*) av_malloc(nbytes);
+    buffer = (uint8_t*) av_malloc(frameSize());
 
     if (rgbFrame)
       av_frame_free(&rgbFrame);
     rgbFrame = av_frame_alloc();
     av_image_fill_arrays(rgbFrame->data, rgbFrame->linesize, buffer,
-                         AV_PIX_FMT_RGB24, w, h, 1);
+                         outFormat, w, h, 1);
+
+    scaleFlags = SWS_FAST_BILINEAR;
+    if (-1 != vidStream)
+      adaptLowres();
+  }
 
+  // (re)builds swsCtx for 'src' to dstW x dstH in dstFormat, with slice
+  // threading where swscale supports it
+  bool prepareScaler(const AVFrame *src, int dstW, int dstH,
+                     AVPixelFormat dstFormat) {
+    int key[7] = { src->width, src->height, src->format, dstW, dstH,
+                   dstFormat, scaleFlags };
+    if (swsCtx && !memcmp(key, swsKey, sizeof(key)))
+      return true;
     if (swsCtx)
       sws_freeContext(swsCtx);
-    swsCtx = sws_getContext(codecCtx->width, codecCtx->height,
-                            codecCtx->pix_fmt, w, h, AV_PIX_FMT_RGB24,
-                            SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+    swsCtx = sws_alloc_context();
+    av_opt_set_int(swsCtx, "srcw", src->width, 0);
+    av_opt_set_int(swsCtx, "srch", src->height, 0);
+    av_opt_set_int(swsCtx, "src_format", src->format, 0);
+    av_opt_set_int(swsCtx, "dstw", dstW, 0);
+    av_opt_set_int(swsCtx, "dsth", dstH, 0);
+    av_opt_set_int(swsCtx, "dst_format", dstFormat, 0);
+    av_opt_set_int(swsCtx, "sws_flags", scaleFlags, 0);
+    av_opt_set_int(swsCtx, "threads", scaleThreads, 0);  // swscale >= 6.1
+    if (sws_init_context(swsCtx, nullptr, nullptr) < 0) {
+      printf("sws_init_context() failed for %d x %d -> %d x %d\n",
+             src->width, src->height, dstW, dstH);
+      sws_freeContext(swsCtx);
+      swsCtx = nullptr;
+      return false;
+    }
+    memcpy(swsKey, key, sizeof(key));
+    return true;
   }
 
-  bool play() {
-    AVPacket packet;
-    if (-1 == vidStream)
-      return false;
+  AVFrame* acquireFrame() {
+    std::lock_guard<std::mutex> lg(poolMutex);
+    if (framePool.empty())
+      return av_frame_alloc();
+    AVFrame *f = framePool.back();
+    framePool.pop_back();
+    return f;
+  }
+
+  void recycle(AVFrame *f) {
+    av_frame_unref(f);
+    std::lock_guard<std::mutex> lg(poolMutex);
+    framePool.push_back(f);
+  }
 
-    auto start = std::chrono::high_resolution_clock::now();
-    while (av_read_frame(fmtCtx, &packet) >= 0) {
-      if (packet.stream_index == vidStream)
+  void demux() {
+    while (!stopping) {
+      AVPacket *packet = av_packet_alloc();
+      int resp = av_read_frame(fmtCtx, packet);
+      if (resp < 0) {
+        av_packet_free(&packet);
+        if (resp != AVERROR_EOF && resp != AVERROR_EXIT)
+          printf("av_read_frame() error: '%s'\n", av_err2str(resp));
+        packets.push(nullptr);
+        return;
+      }
+      if (packet->stream_index != vidStream || !packets.push(packet))
+        av_packet_free(&packet);
+    }
+  }
+
+  // hands every frame the codec has ready to 'frames', false once that
+  // queue was closed under us
+  bool receiveAll(std::chrono::steady_clock::time_point begin) {
+    while (true) {
+      AVFrame *out = acquireFrame();
+      int resp = avcodec_receive_frame(codecCtx, out);
+      auto end = std::chrono::steady_clock::now();
+      decodeBusyNs += uint64_t(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
+              .count());
+      if (resp < 0) {
+        recycle(out);
+        if (resp != AVERROR(EAGAIN) && resp != AVERROR_EOF)
+          printf("avcodec_receive_frame() error: '%s'\n", av_err2str(resp));
+        return true;
+      }
+      decodedFrames++;
+      uint64_t busyNs = decodeBusyNs;
+      double ms = double(busyNs - lastFrameBusyNs) * 1e-6;
+      lastFrameBusyNs = busyNs;
+      double avg = avgProcessTimeInMs;
+      avgProcessTimeInMs = 0.0 == avg ? ms : 0.9 * avg + 0.1 * ms;
+      // streams without pts (raw elementary streams, some TS) still get
+      // paced, everything past here reads 'pts'
+      out->pts = out->best_effort_timestamp;
+      bool pushed = frames.push(out);
+      begin = std::chrono::steady_clock::now();
+      if (!pushed) {
+        recycle(out);
+        return false;
+      }
+    }
+  }
+
+  void decodeLoop() {
+    // a seek may have left frames in the codec
+    if (!receiveAll(std::chrono::steady_clock::now())) {
+      frames.close();
+      return;
+    }
+    AVPacket *packet = nullptr;
+    while (packets.pop(packet)) {
+      bool draining = !packet;
+      int drop = qualityDrop;
+      bool skipping = skipNonRef || drop >= 4;
+      codecCtx->skip_frame = skipping ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+      codecCtx->skip_loop_filter =
+          drop >= 2 ? AVDISCARD_ALL :
+          drop >= 1 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+      codecCtx->skip_idct = drop >= 3 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+      if (skipping && packet)
+        packetsSkipping++;
+      auto begin = std::chrono::steady_clock::now();
+      int resp = avcodec_send_packet(codecCtx, packet);
+      if (packet)
+        av_packet_free(&packet);
+      if (resp < 0 && resp != AVERROR_EOF) {
+        printf("avcodec_send_packet() error: '%s'\n", av_err2str(resp));
+        if (draining)
+          break;
+        continue;
+      }
+      // everything the packet produced, so the next send can't hit EAGAIN;
+      // with frame threads the first frames only show up after a few packets,
+      // the rest come out while draining
+      if (!receiveAll(begin))
+        break;
+      if (draining)
         break;
-      av_packet_unref(&packet);
     }
-    int resp = avcodec_send_packet(codecCtx, &packet);
-    if (resp < 0) {
-      printf("avcodec_send_packet() error: '%s'\n", av_err2str(resp));
-      av_packet_unref(&packet);
+    frames.close();
+  }
+
+
+  void start() {
+    if (started || -1 == vidStream)
+      return;
+    adaptLowres();
+    stopping = false;
+    packets.capacity = maxPackets;
+    frames.capacity = maxFrames;
+    packets.reopen();
+    frames.reopen();
+    demuxer = std::thread(&Player::demux, this);
+    decoder = std::thread(&Player::decodeLoop, this);
+    started = true;
+  }
+
+  // joins both threads and drops whatever was buffered
+  void stop() {
+    if (!started)
+      return;
+    stopping = true;
+    packets.close();
+    frames.close();
+    demuxer.join();
+    decoder.join();
+    AVPacket *packet = nullptr;
+    while (packets.pop(packet))
+      if (packet)
+        av_packet_free(&packet);
+    AVFrame *f = nullptr;
+    while (frames.pop(f))
+      recycle(f);
+    started = false;
+    // the interrupt callback reads it, left set every later av_seek_frame()
+    // in seek() would fail with AVERROR_EXIT
+    stopping = false;
+  }
+
+  // pops the next decoded frame into 'frame', starting the pipeline on first
+  // use; blocks until one is ready, false once the stream is done
+  bool play() {
+    if (-1 == vidStream)
       return false;
+    if (stepped) {
+      // back to the stepped-to frame, half a frame in so rounding can't
+      // land on the one before
+      stepped = false;
+      if (!seek(elapsed + (fps > 0.0 ? 0.5 / fps : 0.02)))
+        return false;
     }
+    start();
 
-    bool playing = true;
-    do {
-      resp = avcodec_receive_frame(codecCtx, frame);
-    } while (resp == AVERROR(EAGAIN));
-
-    if (resp == AVERROR_EOF) {
-      playing = false;
-    } else if (resp < 0) {
-      printf("avcodec_receive_frame() error: '%s'\n", av_err2str(resp));
-      playing = false;
-    } else {
-      elapsed =
-          (frame->pts != AV_NOPTS_VALUE) ?
-              frame->pts * av_q2d(fmtCtx->streams[vidStream]->time_base) : 0.0;
-//      int nbytes = av_image_get_buffer_size(AV_PIX_FMT_RGB24, w, h, 1);
-//      sws_scale(swsCtx, frame->data, frame->linesize, 0, codecCtx->height, rgbFrame->data, rgbFrame->linesize);
-//      {
-//        std::lock_guard<std::mutex> lk(mutex);
-//        memcpy(buffer, rgbFrame->data[0], nbytes);
-//      }
-    }
-    av_packet_unref(&packet);
-    auto stop = std::chrono::high_resolution_clock::now();
+    auto begin = std::chrono::high_resolution_clock::now();
+    AVFrame *next = nullptr;
+    if (!frames.pop(next))
+      return false;
+    av_frame_unref(frame);
+    av_frame_move_ref(frame, next);
+    recycle(next);
+    elapsed =
+        (frame->pts != AV_NOPTS_VALUE) ?
+            frame->pts * av_q2d(fmtCtx->streams[vidStream]->time_base) : 0.0;
+    auto end = std::chrono::high_resolution_clock::now();
     double ms =
         double(
-            std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start)
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
                 .count()) * 1e-6;
-    avgProcessTimeInMs = 0.0 == ms ? ms : 0.9 * avgProcessTimeInMs + 0.1 * ms;
-    return playing;
+    avgWaitMs = 0.0 == avgWaitMs ? ms : 0.9 * avgWaitMs + 0.1 * ms;
+    govern();
+    return true;
+  }
+
+  // see 'qualityDrop'
+  void govern() {
+    if (!adaptive || fps <= 0.0 || ++governFrames < governWindow)
+      return;
+    governFrames = 0;
+    double load = avgProcessTimeInMs * fps * 1e-3;
+    int level = qualityDrop;
+    if (load > degradeAt && level < maxQualityDrop) {
+      qualityDrop = level + 1;
+      calmWindows = 0;
+      qualityChanges++;
+    } else if (load < restoreAt && level > 0) {
+      if (++calmWindows >= restoreWindows) {
+        qualityDrop = level - 1;
+        calmWindows = 0;
+        qualityChanges++;
+      }
+    } else
+      calmWindows = 0;
+  }
+
+  // Like play(), but paced by pts: sleeps until the next frame is due and
+  // returns with it in 'frame'. A frame more than a frame period late is
+  // dropped if a newer one is already waiting, otherwise shown late (it's
+  // decoded anyway, dropping it would only save the scale); past
+  // 'skipAfterMs' the decoder also skips non-reference frames until
+  // playback has caught up.
+  bool present() {
+    using clock = std::chrono::steady_clock;
+    double period = fps > 0.0 ? 1.0 / fps : 0.04;
+    while (play()) {
+      if (frame->pts == AV_NOPTS_VALUE) {
+        framesShown++;
+        return true;
+      }
+      auto now = clock::now();
+      if (clockStart < 0.0)
+        rebase(elapsed, now);
+      auto due = clockBase
+          + std::chrono::duration_cast<clock::duration>(
+              std::chrono::duration<double>(elapsed - clockStart));
+      double lateMs =
+          std::chrono::duration<double, std::milli>(now - due).count();
+      if (lateMs > resyncAfterMs || lateMs < -resyncAfterMs) {
+        // a pts jump or a stall we won't catch up with
+        rebase(elapsed, now);
+        due = now;
+        lateMs = 0.0;
+      }
+      skipNonRef = lateMs > skipAfterMs;
+      if (lateMs > period * 1e3 && frames.size()) {
+        framesDropped++;
+        continue;
+      }
+      if (lateMs > 0.0)
+        framesLate++;
+      else {
+        // sleep most of the way, spin the last stretch
+        std::this_thread::sleep_until(due - std::chrono::milliseconds(1));
+        while (clock::now() < due)
+          std::this_thread::yield();
+      }
+      framesShown++;
+      return true;
+    }
+    return false;
   }
 
+  void rebase(double start, std::chrono::steady_clock::time_point base) {
+    clockStart = start;
+    clockBase = base;
+  }
+
+  // Decodes from the current position up to the frame showing at 'target'
+  // (pts + one frame > target) into 'frame'. Frames before it are only
+  // decoded as far as they serve as references and are never scaled.
+  // 1 = found, -1 = the first frame out was already past the target,
+  // 0 = stream ended or failed.
+  int decodeTo(int64_t target, int64_t frameTicks) {
+    // whatever the governor left set, a seek lands on a full quality frame
+    fullQuality();
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *scratch = acquireFrame();
+    int result = 0;
+    bool first = true;
+    while (!result) {
+      int resp = av_read_frame(fmtCtx, packet);
+      bool eof = resp < 0;
+      if (!eof && packet->stream_index != vidStream) {
+        av_packet_unref(packet);
+        continue;
+      }
+      if (!eof)
+        codecCtx->skip_frame =
+            packet->pts != AV_NOPTS_VALUE && packet->pts + frameTicks <= target ?
+                AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+      avcodec_send_packet(codecCtx, eof ? nullptr : packet);
+      av_packet_unref(packet);
+      while (!result && avcodec_receive_frame(codecCtx, scratch) >= 0) {
+        int64_t pts = scratch->best_effort_timestamp;
+        if (pts == AV_NOPTS_VALUE || pts + frameTicks > target) {
+          result = first && pts != AV_NOPTS_VALUE && pts > target ? -1 : 1;
+          scratch->pts = pts;
+          av_frame_unref(frame);
+          av_frame_move_ref(frame, scratch);
+        }
+        av_frame_unref(scratch);
+        first = false;
+      }
+      if (eof)
+        break;
+    }
+    fullQuality();
+    recycle(scratch);
+    av_packet_free(&packet);
+    return result;
+  }
+
+  // Undoes every shortcut decodeLoop() and the governor set on the codec;
+  // decodeLoop() sets them again per packet once play() restarts it.
+  void fullQuality() {
+    codecCtx->skip_frame = AVDISCARD_DEFAULT;
+    codecCtx->skip_loop_filter = AVDISCARD_DEFAULT;
+    codecCtx->skip_idct = AVDISCARD_DEFAULT;
+  }
+
+  // Puts the frame showing at 'seconds' (same clock as 'elapsed') into
+  // 'frame': jumps to the last keyframe before it and decodes forward.
+  // play() carries on with the frame after.
   bool seek(double seconds) {
-    int64_t timeStamp = int64_t(seconds * AV_TIME_BASE);
-    if (av_seek_frame(fmtCtx, vidStream, timeStamp, AVSEEK_FLAG_BACKWARD)
-        >= 0) {
+    if (-1 == vidStream)
+      return false;
+    stop();
+    clockStart = -1.0;
+    skipNonRef = false;
+    AVStream *stream = fmtCtx->streams[vidStream];
+    AVRational microseconds = av_make_q(1, AV_TIME_BASE);
+    int64_t target = av_rescale_q_rnd(int64_t(seconds * AV_TIME_BASE),
+                                      microseconds, stream->time_base,
+                                      AV_ROUND_DOWN);
+    int64_t frameTicks = 1;
+    if (stream->avg_frame_rate.num && stream->avg_frame_rate.den)
+      frameTicks = std::max<int64_t>(
+          1, av_rescale_q(1, av_inv_q(stream->avg_frame_rate),
+                          stream->time_base));
+
+    int64_t key;
+    {
+      std::lock_guard<std::mutex> lg(indexMutex);
+      key = index.before(target);
+    }
+    int64_t from = key != INT64_MIN ? key : target;
+    for (int attempt = 0; attempt < 4; attempt++) {
+      if (av_seek_frame(fmtCtx, vidStream, from, AVSEEK_FLAG_BACKWARD) < 0)
+        return false;
       avcodec_flush_buffers(codecCtx);
-      play();
+      int result = decodeTo(target, frameTicks);
+      if (result > 0) {
+        elapsed = frame->pts != AV_NOPTS_VALUE ?
+            frame->pts * av_q2d(stream->time_base) : seconds;
+        return true;
+      }
+      if (!result)
+        return false;
+      // the demuxer landed past the target, back off further
+      std::lock_guard<std::mutex> lg(indexMutex);
+      key = index.before(from - 1);
+      from = key != INT64_MIN ?
+          key : from - av_rescale_q(AV_TIME_BASE << attempt, microseconds,
+                                    stream->time_base);
     }
     return false;
   }
 
+  // Keeps up to 'budget' bytes of decoded GOPs for step(), as the decoder's
+  // own frames or, with 'scale' > 1, as 1/scale size copies.
+  bool enableCache(size_t budget, int scale = 1) {
+    if (-1 == vidStream)
+      return false;
+    gopCache = std::make_unique<GopCache>(
+        url, budget, scale, source ? source->reopen() : nullptr);
+    if (!gopCache->open()) {
+      gopCache.reset();
+      return false;
+    }
+    return true;
+  }
+
+  // Moves 'frame' one frame back (dir < 0) or forward (dir > 0) out of the
+  // GOP cache, pausing the pipeline; the GOP beyond is decoded in the
+  // background meanwhile. Reverse playback is step(-1) once a frame period,
+  // play() carries on forward from wherever stepping left off. False at
+  // either end, without a cache, or while the keyframe index is still being
+  // scanned.
+  bool step(int dir) {
+    if (!gopCache || !frame->data[0] || frame->pts == AV_NOPTS_VALUE)
+      return false;
+    if (!gopCache->hasKeyframes()) {
+      std::lock_guard<std::mutex> lg(indexMutex);
+      if (index.empty())
+        return false;
+      gopCache->setKeyframes(index.pts, index.reorders);
+    }
+    stop();
+    AVFrame *next = gopCache->step(frame->pts, dir);
+    if (!next)
+      return false;
+    av_frame_unref(frame);
+    av_frame_move_ref(frame, next);
+    av_frame_free(&next);
+    elapsed = frame->pts * av_q2d(fmtCtx->streams[vidStream]->time_base);
+    clockStart = -1.0;
+    stepped = true;
+    return true;
+  }
+
+  // Keyframe-only pass over the whole stream, for previews. Non-key packets
+  // never reach the decoder, and with 'every' > 0 only the first keyframe in
+  // each 'every' seconds does; loop filtering is off too, so long recordings
+  // go about as fast as they can be read. 'fn' gets each keyframe with its
+  // time and returns false to stop. Playback starts over afterwards. Returns
+  // the times of the keyframes handed out.
+  std::vector<double> thumbnails(
+      double every,
+      const std::function<bool(const AVFrame *key, double seconds)> &fn) {
+    std::vector<double> times;
+    if (-1 == vidStream)
+      return times;
+    stop();
+    AVStream *stream = fmtCtx->streams[vidStream];
+    double tb = av_q2d(stream->time_base);
+    int64_t first = stream->start_time != AV_NOPTS_VALUE ?
+        stream->start_time : 0;
+    if (av_seek_frame(fmtCtx, vidStream, first, AVSEEK_FLAG_BACKWARD) < 0)
+      return times;
+    avcodec_flush_buffers(codecCtx);
+    fullQuality();
+    codecCtx->skip_frame = AVDISCARD_NONKEY;
+    codecCtx->skip_loop_filter = AVDISCARD_ALL;
+
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *key = acquireFrame();
+    double due = -DBL_MAX;  // by packet, the decoder may hold frames back
+    bool more = true;
+    auto receive = [&]() {
+      while (more && avcodec_receive_frame(codecCtx, key) >= 0) {
+        double seconds = key->best_effort_timestamp != AV_NOPTS_VALUE ?
+            key->best_effort_timestamp * tb : 0.0;
+        times.push_back(seconds);
+        more = fn(key, seconds);
+        av_frame_unref(key);
+      }
+    };
+    while (more && av_read_frame(fmtCtx, packet) >= 0) {
+      bool wanted = packet->stream_index == vidStream
+          && (packet->flags & AV_PKT_FLAG_KEY);
+      if (wanted && every > 0.0 && packet->pts != AV_NOPTS_VALUE) {
+        double seconds = packet->pts * tb;
+        wanted = seconds >= due;
+        if (due == -DBL_MAX)
+          due = seconds;
+        while (due <= seconds)  // slots stay put, no drift from late keys
+          due += every;
+      }
+      if (wanted)
+        avcodec_send_packet(codecCtx, packet);
+      av_packet_unref(packet);
+      if (wanted)
+        receive();
+    }
+    if (more) {
+      avcodec_send_packet(codecCtx, nullptr);
+      receive();
+    }
+
+    fullQuality();
+    recycle(key);
+    av_packet_free(&packet);
+    av_seek_frame(fmtCtx, vidStream, first, AVSEEK_FLAG_BACKWARD);
+    avcodec_flush_buffers(codecCtx);
+    elapsed = 0.0;
+    clockStart = -1.0;
+    stepped = false;
+    return times;
+  }
+
+  // through thumbSws, apart from playback's swsCtx
+  bool scaleThumb(const AVFrame *src, sdl2::Pixels &dst) {
+    return scaleInto(thumbSws, src, dst, SWS_AREA);
+  }
+
+  // thumbnail height for 'thumbW' at the video's aspect
+  int thumbHeight(int thumbW) const {
+    if (!codecCtx || codecCtx->width <= 0)
+      return thumbW;
+    return std::max(1, int(int64_t(thumbW) * codecCtx->height
+                           / codecCtx->width));
+  }
+
+  // cols x rows keyframes spread evenly over the stream, each scaled
+  // straight into its cell of one sheet, saved as PNG to 'path'. 'thumbH'
+  // = 0 keeps the aspect. Returns the thumbnails' times.
+  std::vector<double> contactSheet(std::string_view path, int cols, int rows,
+                                   int thumbW, int thumbH = 0) {
+    if (-1 == vidStream || cols <= 0 || rows <= 0 || thumbW <= 0)
+      return {};
+    if (thumbH <= 0)
+      thumbH = thumbHeight(thumbW);
+    sdl2::Bitmap sheet(cols * thumbW, rows * thumbH, 24, "contact sheet");
+    if (!sheet.surf)
+      return {};
+    sheet.lock();
+    sheet.pixels.clear(sdl2::Pixel24(0, 0, 0));
+    int count = cols * rows;
+    double every = duration > 0.0 ? duration / count : 0.0;
+    int i = 0;
+    auto times = thumbnails(every, [&](const AVFrame *key, double) {
+      sdl2::Pixels cell = sheet.pixels;
+      cell.data = &cell.data[(i / cols) * thumbH * cell.p
+          + (i % cols) * thumbW * 3];
+      cell.w = thumbW;
+      cell.h = thumbH;
+      scaleThumb(key, cell);
+      return ++i < count;
+    });
+    sheet.unlock();
+    sheet.savePNG(path);
+    return times;
+  }
+
+  // one PNG per keyframe (per 'every' seconds, if set), 'pattern' being a
+  // printf format taking the thumbnail's index
+  std::vector<double> thumbnailFiles(const std::string &pattern, int thumbW,
+                                     int thumbH = 0, double every = 0.0) {
+    if (-1 == vidStream || thumbW <= 0)
+      return {};
+    if (thumbH <= 0)
+      thumbH = thumbHeight(thumbW);
+    sdl2::Bitmap thumb(thumbW, thumbH, 24, "thumbnail");
+    if (!thumb.surf)
+      return {};
+    int i = 0;
+    return thumbnails(every, [&](const AVFrame *key, double) {
+      thumb.lock();
+      bool scaled = scaleThumb(key, thumb.pixels);
+      thumb.unlock();
+      if (scaled) {
+        char name[1024];
+        snprintf(name, sizeof(name), pattern.c_str(), i);
+        thumb.savePNG(name);
+      }
+      i++;
+      return true;
+    });
+  }
+
+  double decodeFps() const {
+    uint64_t ns = decodeBusyNs;
+    return ns ? double(decodedFrames) * 1e9 / double(ns) : 0.0;
+  }
+
+  void report() const {
+    printf("player: %llu frames decoded at %.1f fps (%d threads), "
+           "%.3f ms decoding and %.3f ms waited per frame\n",
+           (unsigned long long) decodedFrames.load(), decodeFps(),
+           codecCtx ? codecCtx->thread_count : 0, avgProcessTimeInMs.load(),
+           avgWaitMs);
+    printf("player: %llu frames shown, %llu late, %llu dropped, "
+           "%llu packets decoded skipping non-reference frames\n",
+           (unsigned long long) framesShown, (unsigned long long) framesLate,
+           (unsigned long long) framesDropped,
+           (unsigned long long) packetsSkipping.load());
+    printf("player: lowres %d, quality drop %d of %d, %llu changes\n", lowres,
+           qualityDrop.load(), maxQualityDrop,
+           (unsigned long long) qualityChanges);
+    if (gopCache)
+      gopCache->report();
+  }
+
+  // scales the current frame into 'buffer' (w x h in outFormat)
   void decode() {
-    int nbytes = av_image_get_buffer_size(AV_PIX_FMT_RGB24, w, h, 1);
-    sws_scale(swsCtx, frame->data, frame->linesize, 0, codecCtx->height,
+    if (!frame->data[0] || !prepareScaler(frame, w, h, outFormat))
+      return;
+    sws_scale(swsCtx, frame->data, frame->linesize, 0, frame->height,
               rgbFrame->data, rgbFrame->linesize);
-    memcpy(buffer, rgbFrame->data[0], nbytes);
+  }
+
+  // scales the current frame straight into 'dst' (BGRA for 32 bpp, BGR for
+  // 24), to its size and pitch; an inverted target is written bottom-up
+  bool decode(sdl2::Pixels &dst) {
+    AVPixelFormat format = scaleFormat(dst);
+    if (!frame->data[0] || format == AV_PIX_FMT_NONE
+        || !prepareScaler(frame, dst.w, dst.h, format))
+      return false;
+    scalePixels(swsCtx, frame, dst);
+    return true;
+  }
+
+  bool decode(SDL_Surface *dst) {
+    if (!dst
+        || (dst->format->BytesPerPixel != 3 && dst->format->BytesPerPixel != 4))
+      return false;
+    bool unlock = false;
+    if (SDL_MUSTLOCK(dst) && !dst->locked) {
+      unlock = true;
+      SDL_LockSurface(dst);
+    }
+    sdl2::Pixels pixels;
+    pixels.data = (Uint8*) dst->pixels;
+    pixels.w = dst->w;
+    pixels.h = dst->h;
+    pixels.p = dst->pitch;
+    pixels.bpp = dst->format->BytesPerPixel * 8;
+    bool done = decode(pixels);
+    if (unlock)
+      SDL_UnlockSurface(dst);
+    return done;
   }
 
   ~Player() {
+    stop();
+    closing = true;
+    if (indexer.joinable())
+      indexer.join();
+    for (auto f : framePool)
+      av_frame_free(&f);
+    framePool.clear();
     if (buffer) {
       av_free(buffer);
       buffer = nullptr;
@@ -195,6 +1054,10 @@ struct Player {
       sws_freeContext(swsCtx);
       swsCtx = nullptr;
     }
+    if (thumbSws) {
+      sws_freeContext(thumbSws);
+      thumbSws = nullptr;
+    }
     if (frame) {
       av_frame_free(&frame);
       frame = nullptr;
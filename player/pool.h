@@ -0,0 +1,518 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+#include "mysdl2.h"
+#include "scale.h"
+
+// Many streams on a fixed set of workers, each stream scaled straight into
+// its cell of one shared mosaic. Instead of a thread per stream, every stream
+// has a reader and a decoder task that go round a single FIFO: a task does a
+// bounded step (a burst of packets, or one frame) and queues itself at the
+// back again, so all streams get their turn however many there are.
+//
+// Packets wait in a bounded queue per stream. A reader with a full queue
+// parks until its decoder has worked it down to half, a decoder with nothing
+// to do parks until its reader brings more, so a slow or stalled source only
+// ever holds up itself. Reads give up after 'readTimeoutMs' and retry later
+// from the last packet queued, and at most half the workers read at once,
+// which leaves the rest to decode.
+//
+// Decoders are single-threaded, the parallelism is across streams. With
+// 'paced' set every stream runs on its own pts clock, a frame that comes up
+// more than a frame period late is dropped instead of scaled when a newer
+// one is already decoded, and shown late otherwise.
+//
+// The cells are written while the mosaic may be on screen, so the consumer
+// can see a cell half updated; 'shown' ticks for every frame drawn.
+struct PlayerPool {
+  using clock = std::chrono::steady_clock;
+
+  struct Stream {
+    PlayerPool *pool = nullptr;
+    std::string url;
+    AVFormatContext *fmtCtx = nullptr;
+    AVCodecContext *codecCtx = nullptr;
+    int vidStream = -1;
+    AVRational timeBase { 0, 1 };
+    double period = 0.04;  // seconds per frame
+    SwsContext *swsCtx = nullptr;
+    sdl2::Pixels cell;  // a view into the pool's target
+    AVFrame *frame = nullptr;
+    bool pending = false;  // 'frame' decoded and waiting for its turn
+    clock::time_point deadline;  // for the read in progress
+
+    // behind the pool's mutex
+    std::deque<AVPacket*> packets;  // nullptr marks the end
+    bool readerParked = false, decoderParked = true, done = false;
+    uint64_t packetsRead = 0, stalls = 0;
+    size_t queuePeak = 0;
+
+    // reader side only
+    int64_t lastDts = AV_NOPTS_VALUE;  // of the last packet queued
+    bool resync = false;  // a read timed out partway, seek back first
+    bool skipping = false;  // dropping packets up to 'lastDts' after that
+
+    // decoder side only
+    AVFrame *newer = nullptr;  // a late 'frame' checks for a successor here
+    double clockStart = -1.0;
+    clock::time_point clockBase;
+
+    std::atomic<uint64_t> framesDecoded { 0 }, framesShown { 0 },
+        framesDropped { 0 };
+    std::atomic<double> decodeMs { 0.0 };  // smoothed, per packet
+  };
+
+  struct Task {
+    Stream *stream;
+    bool read;
+  };
+
+  struct Timed {
+    clock::time_point at;
+    Task task;
+    bool operator >(const Timed &rhs) const {
+      return at > rhs.at;
+    }
+  };
+
+  int workers = 0;
+  size_t maxPackets = 64;
+  int readBurst = 8;
+  int readTimeoutMs = 5000;
+  int retryMs = 100;  // after a timed out read
+  bool paced = true;
+
+  std::vector<std::unique_ptr<Stream>> streams;
+  sdl2::Pixels target;
+  std::atomic<uint64_t> shown { 0 };
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<Task> ready;
+  std::priority_queue<Timed, std::vector<Timed>, std::greater<Timed>> timed;
+  std::vector<std::thread> threads;
+  int readers = 0, maxReaders = 1, live = 0;
+  std::atomic<bool> quit { false };
+
+  // 'workers' = 0 starts one per core
+  PlayerPool(int workers_ = 0)
+      :
+      workers(workers_) {
+    if (workers <= 0)
+      workers = std::max(1, int(std::thread::hardware_concurrency()));
+    maxReaders = std::max(1, workers / 2);
+  }
+
+  PlayerPool(const PlayerPool&) = delete;
+  PlayerPool& operator =(const PlayerPool&) = delete;
+
+  ~PlayerPool() {
+    stop();
+    for (auto &s : streams) {
+      sws_freeContext(s->swsCtx);
+      av_frame_free(&s->frame);
+      av_frame_free(&s->newer);
+      if (s->codecCtx)
+        avcodec_free_context(&s->codecCtx);
+      if (s->fmtCtx)
+        avformat_close_input(&s->fmtCtx);
+    }
+  }
+
+  static int interrupt(void *opaque) {
+    Stream *s = (Stream*) opaque;
+    return s->pool->quit || clock::now() > s->deadline;
+  }
+
+  // opens 'url' as the next cell, -1 if it can't be played
+  int add(std::string_view url) {
+    auto s = std::make_unique<Stream>();
+    s->pool = this;
+    s->url = url;
+    s->fmtCtx = avformat_alloc_context();
+    s->fmtCtx->interrupt_callback.callback = interrupt;
+    s->fmtCtx->interrupt_callback.opaque = s.get();
+    s->deadline = clock::now() + std::chrono::milliseconds(readTimeoutMs);
+    if (avformat_open_input(&s->fmtCtx, s->url.c_str(), nullptr, nullptr)
+        != 0) {
+      printf("PlayerPool failed to open '%s'\n", s->url.c_str());
+      return -1;
+    }
+    // probing gets a timeout of its own, a slow open shouldn't eat it
+    s->deadline = clock::now() + std::chrono::milliseconds(readTimeoutMs);
+    avformat_find_stream_info(s->fmtCtx, nullptr);
+    s->vidStream = av_find_best_stream(s->fmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1,
+                                       nullptr, 0);
+    if (s->vidStream < 0) {
+      printf("PlayerPool: no video in '%s'\n", s->url.c_str());
+      avformat_close_input(&s->fmtCtx);
+      return -1;
+    }
+    AVStream *stream = s->fmtCtx->streams[s->vidStream];
+    s->timeBase = stream->time_base;
+    if (stream->avg_frame_rate.num > 0 && stream->avg_frame_rate.den > 0)
+      s->period = 1.0 / av_q2d(stream->avg_frame_rate);
+    // only the video stream is read through
+    for (int i = 0; i < (int) s->fmtCtx->nb_streams; i++)
+      if (i != s->vidStream)
+        s->fmtCtx->streams[i]->discard = AVDISCARD_ALL;
+
+    const AVCodec *codec = avcodec_find_decoder(stream->codecpar->codec_id);
+    s->codecCtx = avcodec_alloc_context3(codec);
+    avcodec_parameters_to_context(s->codecCtx, stream->codecpar);
+    s->codecCtx->thread_count = 1;  // the parallelism is across streams
+    if (!codec || avcodec_open2(s->codecCtx, codec, nullptr) < 0) {
+      printf("PlayerPool: no decoder for '%s'\n", s->url.c_str());
+      avcodec_free_context(&s->codecCtx);
+      avformat_close_input(&s->fmtCtx);
+      return -1;
+    }
+    s->frame = av_frame_alloc();
+    s->newer = av_frame_alloc();
+    streams.push_back(std::move(s));
+    return int(streams.size()) - 1;
+  }
+
+  // Splits 'target' into a grid of 'cols' columns (0 = as square as it
+  // gets), one cell per stream in the order they were added, each picture
+  // fit into its cell keeping the aspect. Call before start().
+  void layout(const sdl2::Pixels &target_, int cols = 0) {
+    target = target_;
+    int n = int(streams.size());
+    if (!n || !target.hasData())
+      return;
+    if (cols <= 0)
+      while (cols * cols < n)
+        cols++;
+    int rows = (n + cols - 1) / cols;
+    int cellW = target.w / cols, cellH = target.h / rows;
+    for (int i = 0; i < n; i++) {
+      Stream &s = *streams[i];
+      int w = cellW, h = cellH;
+      int srcW = s.codecCtx->width, srcH = s.codecCtx->height;
+      if (srcW > 0 && srcH > 0) {
+        if (int64_t(srcW) * cellH > int64_t(srcH) * cellW)
+          h = std::max(1, int(int64_t(cellW) * srcH / srcW));
+        else
+          w = std::max(1, int(int64_t(cellH) * srcW / srcH));
+      }
+      int x = (i % cols) * cellW + (cellW - w) / 2;
+      int y = (i / cols) * cellH + (cellH - h) / 2;
+      // an inverted target keeps image row y at memory row h - 1 - y
+      int row = target.inverted ? target.h - y - h : y;
+      s.cell = target;
+      s.cell.data = &target.data[row * target.p + x * target.bpp / 8];
+      s.cell.w = w;
+      s.cell.h = h;
+    }
+  }
+
+  bool start() {
+    if (!threads.empty() || streams.empty())
+      return false;
+    quit = false;
+    {
+      std::lock_guard<std::mutex> lg(mutex);
+      for (auto &s : streams)
+        if (!s->done) {
+          ready.push_back( { s.get(), true });
+          live++;
+        }
+    }
+    for (int i = 0; i < workers; i++)
+      threads.emplace_back(&PlayerPool::work, this);
+    return true;
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lg(mutex);
+      quit = true;
+    }
+    cv.notify_all();
+    for (auto &thread : threads)
+      thread.join();
+    threads.clear();
+    ready.clear();
+    timed = decltype(timed)();
+    for (auto &s : streams) {
+      for (auto packet : s->packets)
+        av_packet_free(&packet);
+      s->packets.clear();
+    }
+  }
+
+  // false once every stream has ended
+  bool running() {
+    std::lock_guard<std::mutex> lg(mutex);
+    return live > 0 && !quit;
+  }
+
+  void report() {
+    std::lock_guard<std::mutex> lg(mutex);
+    printf("PlayerPool: %zu streams on %d workers, %llu frames shown\n",
+           streams.size(), workers, (unsigned long long) shown.load());
+    for (size_t i = 0; i < streams.size(); i++) {
+      Stream &s = *streams[i];
+      printf(" %2zu: %llu packets, %llu decoded, %llu shown, %llu dropped, "
+             "%llu stalls, queue peak %zu, %.3f ms/packet%s - %s\n",
+             i, (unsigned long long) s.packetsRead,
+             (unsigned long long) s.framesDecoded.load(),
+             (unsigned long long) s.framesShown.load(),
+             (unsigned long long) s.framesDropped.load(),
+             (unsigned long long) s.stalls, s.queuePeak, s.decodeMs.load(),
+             s.done ? ", ended" : "", s.url.c_str());
+    }
+  }
+
+  void work() {
+    std::unique_lock<std::mutex> lk(mutex);
+    while (!quit) {
+      auto now = clock::now();
+      while (!timed.empty() && timed.top().at <= now) {
+        ready.push_back(timed.top().task);
+        timed.pop();
+      }
+      auto it = std::find_if(ready.begin(), ready.end(), [this](Task &t) {
+        return !t.read || readers < maxReaders;
+      });
+      if (it == ready.end()) {
+        if (timed.empty())
+          cv.wait(lk);
+        else {
+          auto at = timed.top().at;  // the heap changes while we wait
+          cv.wait_until(lk, at);
+        }
+        continue;
+      }
+      Task task = *it;
+      ready.erase(it);
+      if (task.read)
+        readers++;
+      lk.unlock();
+      if (task.read)
+        readStep(*task.stream);
+      else
+        decodeStep(*task.stream);
+      lk.lock();
+      if (task.read) {
+        readers--;
+        cv.notify_one();  // a read slot came free
+      }
+    }
+  }
+
+  // these two expect the lock held
+  void schedule(Task task) {
+    ready.push_back(task);
+    cv.notify_one();
+  }
+
+  void scheduleAt(clock::time_point at, Task task) {
+    timed.push( { at, task });
+    cv.notify_one();
+  }
+
+  void readStep(Stream &s) {
+    if (s.resync && !seekBack(s))
+      return;
+    for (int i = 0; i < readBurst && !quit; i++) {
+      {
+        std::lock_guard<std::mutex> lg(mutex);
+        if (s.packets.size() >= maxPackets) {
+          s.readerParked = true;
+          return;
+        }
+      }
+      AVPacket *packet = av_packet_alloc();
+      s.deadline = clock::now() + std::chrono::milliseconds(readTimeoutMs);
+      int resp = av_read_frame(s.fmtCtx, packet);
+      std::lock_guard<std::mutex> lg(mutex);
+      if (resp < 0) {
+        av_packet_free(&packet);
+        if (quit)
+          return;
+        if (resp == AVERROR_EXIT || resp == AVERROR(EAGAIN)) {
+          // timed out: leave the worker to the other streams for a while,
+          // the demuxer is somewhere mid-sample now
+          s.resync = resp == AVERROR_EXIT;
+          s.stalls++;
+          scheduleAt(clock::now() + std::chrono::milliseconds(retryMs),
+                     { &s, true });
+          return;
+        }
+        s.packets.push_back(nullptr);  // the decoder drains on this
+        wakeDecoder(s);
+        return;
+      }
+      if (packet->stream_index != s.vidStream) {
+        av_packet_free(&packet);
+        continue;
+      }
+      if (s.skipping) {
+        if (packet->dts != AV_NOPTS_VALUE && packet->dts <= s.lastDts) {
+          av_packet_free(&packet);
+          continue;  // queued before the timeout
+        }
+        s.skipping = false;
+      }
+      if (packet->dts != AV_NOPTS_VALUE)
+        s.lastDts = packet->dts;
+      s.packets.push_back(packet);
+      s.packetsRead++;
+      s.queuePeak = std::max(s.queuePeak, s.packets.size());
+      wakeDecoder(s);
+    }
+    std::lock_guard<std::mutex> lg(mutex);
+    if (!quit)
+      schedule( { &s, true });
+  }
+
+  // An av_read_frame() broken off by the interrupt callback leaves the
+  // sample in progress half read and the AVIOContext's eof/error flags set,
+  // so the next read could end the stream. Clears them and seeks back to the
+  // last packet queued, which readStep() then skips up to. False, with a
+  // retry scheduled, if the seek timed out as well; a source that can't seek
+  // at all just reads on.
+  bool seekBack(Stream &s) {
+    if (s.fmtCtx->pb) {
+      s.fmtCtx->pb->eof_reached = 0;
+      s.fmtCtx->pb->error = 0;
+    }
+    AVStream *stream = s.fmtCtx->streams[s.vidStream];
+    int64_t to = s.lastDts != AV_NOPTS_VALUE ? s.lastDts :
+        stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    s.deadline = clock::now() + std::chrono::milliseconds(readTimeoutMs);
+    int resp = av_seek_frame(s.fmtCtx, s.vidStream, to, AVSEEK_FLAG_BACKWARD);
+    std::lock_guard<std::mutex> lg(mutex);
+    if (resp == AVERROR_EXIT) {
+      if (!quit) {
+        s.stalls++;
+        scheduleAt(clock::now() + std::chrono::milliseconds(retryMs),
+                   { &s, true });
+      }
+      return false;
+    }
+    s.resync = false;
+    s.skipping = resp >= 0 && s.lastDts != AV_NOPTS_VALUE;
+    return true;
+  }
+
+  void wakeDecoder(Stream &s) {
+    if (s.decoderParked) {
+      s.decoderParked = false;
+      schedule( { &s, false });
+    }
+  }
+
+  // Shows the pending frame once it's due, then decodes the next one. A late
+  // frame is only dropped for a newer one the codec already has, scaling is
+  // all dropping saves; with none, it's shown late.
+  void decodeStep(Stream &s) {
+    while (s.pending) {
+      auto now = clock::now();
+      bool late = false;
+      if (paced && s.frame->best_effort_timestamp != AV_NOPTS_VALUE) {
+        double pts = s.frame->best_effort_timestamp * av_q2d(s.timeBase);
+        auto due = now;
+        if (s.clockStart >= 0.0)
+          due = s.clockBase
+              + std::chrono::duration_cast<clock::duration>(
+                  std::chrono::duration<double>(pts - s.clockStart));
+        double lateS = std::chrono::duration<double>(now - due).count();
+        if (s.clockStart < 0.0 || lateS > 1.0 || lateS < -1.0) {
+          // first frame, a pts jump or a long stall: restart the clock
+          s.clockStart = pts;
+          s.clockBase = now;
+          lateS = 0.0;
+        } else if (lateS < 0.0) {
+          std::lock_guard<std::mutex> lg(mutex);
+          scheduleAt(due, { &s, false });
+          return;
+        }
+        late = lateS > s.period;
+      }
+      if (late && avcodec_receive_frame(s.codecCtx, s.newer) >= 0) {
+        s.framesDropped++;
+        s.framesDecoded++;
+        std::swap(s.frame, s.newer);
+        av_frame_unref(s.newer);
+        continue;
+      }
+      if (show(s)) {
+        s.framesShown++;
+        shown++;
+      }
+      av_frame_unref(s.frame);
+      s.pending = false;
+    }
+
+    while (!quit) {
+      int resp = avcodec_receive_frame(s.codecCtx, s.frame);
+      if (resp >= 0) {
+        s.framesDecoded++;
+        s.pending = true;
+        break;
+      }
+      if (resp != AVERROR(EAGAIN)) {
+        std::lock_guard<std::mutex> lg(mutex);
+        s.done = true;
+        live--;
+        return;
+      }
+      AVPacket *packet = nullptr;
+      {
+        std::lock_guard<std::mutex> lg(mutex);
+        if (s.packets.empty()) {
+          s.decoderParked = true;
+          return;
+        }
+        packet = s.packets.front();
+        s.packets.pop_front();
+        if (s.readerParked && s.packets.size() <= maxPackets / 2) {
+          s.readerParked = false;
+          schedule( { &s, true });
+        }
+      }
+      auto begin = clock::now();
+      resp = avcodec_send_packet(s.codecCtx, packet);
+      double ms = std::chrono::duration<double, std::milli>(
+          clock::now() - begin).count();
+      s.decodeMs = 0.0 == s.decodeMs ? ms : 0.9 * s.decodeMs + 0.1 * ms;
+      if (packet)
+        av_packet_free(&packet);
+      if (resp < 0 && resp != AVERROR_EOF)
+        printf("PlayerPool: avcodec_send_packet() error: '%s'\n",
+               av_err2str(resp));
+    }
+    std::lock_guard<std::mutex> lg(mutex);
+    if (!quit)
+      schedule( { &s, false });
+  }
+
+  bool show(Stream &s) {
+    return scaleInto(s.swsCtx, s.frame, s.cell, SWS_AREA);
+  }
+};
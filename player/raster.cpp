@@ -0,0 +1,332 @@
+#include "raster.h"
+#include "jobs.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace sdl2;
+
+static inline Sint64 floorDiv(Sint64 a, Sint64 b) {
+  Sint64 q = a / b;
+  return (a % b != 0 && ((a < 0) != (b < 0))) ? q - 1 : q;
+}
+
+static inline Sint64 ceilDiv(Sint64 a, Sint64 b) {
+  return -floorDiv(-a, b);
+}
+
+Canvas::Canvas(const Pixels &pixels)
+    :
+    pixels(pixels),
+    clip(0, 0, pixels.w, pixels.h) {
+}
+
+Canvas::Canvas(const Pixels &pixels, const Rect &r)
+    :
+    pixels(pixels) {
+  int x0 = std::max(r.x, 0), y0 = std::max(r.y, 0);
+  int x1 = std::min(r.x + r.w, pixels.w), y1 = std::min(r.y + r.h, pixels.h);
+  clip = Rect(x0, y0, std::max(x1 - x0, 0), std::max(y1 - y0, 0));
+}
+
+void Canvas::span(int x0, int x1, int y, const Pixel32 &color) {
+  if (!drawable() || y < clip.y || y >= clip.y + clip.h)
+    return;
+  x0 = std::max(x0, clip.x);
+  x1 = std::min(x1, clip.x + clip.w - 1);
+  if (x0 > x1)
+    return;
+  Uint8 *pixel = at(x0, y);
+  if (pixels.bpp == 32)
+    std::fill_n((Pixel32*) pixel, x1 - x0 + 1, color);
+  else
+    for (int x = x0; x <= x1; x++, pixel += 3)
+      put(pixel, color);
+}
+
+// Bresenham with the minor axis offset at step k defined as
+// floor((2 * k * minor + major) / (2 * major)), which lets the clip rect be
+// turned into a [kStart, kEnd] step range up front. The pixels drawn don't
+// depend on the clip, so a line split across tiles has no seams.
+void Canvas::line(Coord a, Coord b, const Pixel32 &color) {
+  if (!drawable() || clip.w <= 0 || clip.h <= 0)
+    return;
+  int xMin = clip.x, xMax = clip.x + clip.w - 1;
+  int yMin = clip.y, yMax = clip.y + clip.h - 1;
+  // trivial reject, both ends beyond the same edge
+  if ((a.x < xMin && b.x < xMin) || (a.x > xMax && b.x > xMax) || (a.y < yMin && b.y < yMin)
+      || (a.y > yMax && b.y > yMax))
+    return;
+
+  int dx = abs(b.x - a.x), dy = abs(b.y - a.y);
+  int sx = b.x < a.x ? -1 : 1, sy = b.y < a.y ? -1 : 1;
+  bool xMajor = dx >= dy;
+  Sint64 n = xMajor ? dx : dy;
+  Sint64 m = xMajor ? dy : dx;
+  if (n == 0) {
+    if (inside(a.x, a.y))
+      put(at(a.x, a.y), color);
+    return;
+  }
+
+  int ma = xMajor ? a.x : a.y, mi = xMajor ? a.y : a.x;
+  int sMa = xMajor ? sx : sy, sMi = xMajor ? sy : sx;
+  int loMa = xMajor ? xMin : yMin, hiMa = xMajor ? xMax : yMax;
+  int loMi = xMajor ? yMin : xMin, hiMi = xMajor ? yMax : xMax;
+
+  Sint64 kStart = 0, kEnd = n;
+  if (sMa > 0) {
+    kStart = std::max<Sint64>(kStart, loMa - ma);
+    kEnd = std::min<Sint64>(kEnd, hiMa - ma);
+  } else {
+    kStart = std::max<Sint64>(kStart, ma - hiMa);
+    kEnd = std::min<Sint64>(kEnd, ma - loMa);
+  }
+  Sint64 offLo = sMi > 0 ? loMi - mi : mi - hiMi;
+  Sint64 offHi = sMi > 0 ? hiMi - mi : mi - loMi;
+  if (m == 0) {
+    if (offLo > 0 || offHi < 0)
+      return;
+  } else {
+    kStart = std::max(kStart, ceilDiv(2 * n * offLo - n, 2 * m));
+    kEnd = std::min(kEnd, floorDiv(2 * n * (offHi + 1) - n - 1, 2 * m));
+  }
+  if (kStart > kEnd)
+    return;
+
+  Sint64 off = floorDiv(2 * kStart * m + n, 2 * n);
+  Sint64 err = 2 * kStart * m + n - 2 * n * (off + 1);
+  int bytes = pixels.bpp / 8;
+  int rowStep = pixels.inverted ? -pixels.p : pixels.p;
+  int stepMa = xMajor ? sx * bytes : sy * rowStep;
+  int stepMi = xMajor ? sy * rowStep : sx * bytes;
+  int x = xMajor ? ma + sMa * int(kStart) : mi + sMi * int(off);
+  int y = xMajor ? mi + sMi * int(off) : ma + sMa * int(kStart);
+
+  Uint8 *pixel = at(x, y);
+  for (Sint64 k = kStart; k <= kEnd; k++) {
+    put(pixel, color);
+    pixel += stepMa;
+    err += 2 * m;
+    if (err >= 0) {
+      pixel += stepMi;
+      err -= 2 * n;
+    }
+  }
+}
+
+void Canvas::rect(const Rect &r, const Pixel32 &color) {
+  if (r.w <= 0 || r.h <= 0)
+    return;
+  int x1 = r.x + r.w - 1, y1 = r.y + r.h - 1;
+  span(r.x, x1, r.y, color);
+  if (y1 != r.y)
+    span(r.x, x1, y1, color);
+  if (r.h > 2) {
+    line(Coord(r.x, r.y + 1), Coord(r.x, y1 - 1), color);
+    if (x1 != r.x)
+      line(Coord(x1, r.y + 1), Coord(x1, y1 - 1), color);
+  }
+}
+
+void Canvas::fillRect(const Rect &r, const Pixel32 &color) {
+  int y0 = std::max(r.y, clip.y), y1 = std::min(r.y + r.h, clip.y + clip.h);
+  for (int y = y0; y < y1; y++)
+    span(r.x, r.x + r.w - 1, y, color);
+}
+
+void Canvas::circle(Coord c, int radius, const Pixel32 &color) {
+  if (radius < 0 || !drawable())
+    return;
+  bool contained = inside(c.x - radius, c.y - radius) && inside(c.x + radius, c.y + radius);
+  if (!contained && (c.x + radius < clip.x || c.x - radius >= clip.x + clip.w || c.y + radius < clip.y
+      || c.y - radius >= clip.y + clip.h))
+    return;
+
+  auto plot = [&](int x, int y) {
+    if (contained || inside(x, y))
+      put(at(x, y), color);
+  };
+  int x = radius, y = 0, err = 1 - radius;
+  while (x >= y) {
+    plot(c.x + x, c.y + y);
+    plot(c.x - x, c.y + y);
+    plot(c.x + x, c.y - y);
+    plot(c.x - x, c.y - y);
+    plot(c.x + y, c.y + x);
+    plot(c.x - y, c.y + x);
+    plot(c.x + y, c.y - x);
+    plot(c.x - y, c.y - x);
+    y++;
+    if (err < 0)
+      err += 2 * y + 1;
+    else {
+      x--;
+      err += 2 * (y - x) + 1;
+    }
+  }
+}
+
+void Canvas::fillCircle(Coord c, int radius, const Pixel32 &color) {
+  if (radius < 0 || !drawable())
+    return;
+  int y0 = std::max(c.y - radius, clip.y), y1 = std::min(c.y + radius, clip.y + clip.h - 1);
+  Sint64 rr = Sint64(radius) * radius + radius;  // matches the midpoint outline
+  for (int y = y0; y <= y1; y++) {
+    Sint64 dy = y - c.y;
+    int half = int(sqrt(double(rr - dy * dy)));
+    span(c.x - half, c.x + half, y, color);
+  }
+}
+
+void Canvas::triangle(Coord a, Coord b, Coord c, const Pixel32 &color) {
+  Coord points[3] = { a, b, c };
+  polygon(points, 3, color);
+}
+
+void Canvas::polygon(const Coord *points, int count, const Pixel32 &color) {
+  if (count < 3 || !drawable())
+    return;
+  int top = points[0].y, bottom = points[0].y;
+  for (int i = 1; i < count; i++) {
+    top = std::min(top, points[i].y);
+    bottom = std::max(bottom, points[i].y);
+  }
+  top = std::max(top, clip.y);
+  bottom = std::min(bottom, clip.y + clip.h - 1);
+
+  static thread_local std::vector<double> xs;
+  for (int y = top; y <= bottom; y++) {
+    xs.clear();
+    for (int i = 0, j = count - 1; i < count; j = i++) {
+      const Coord &p = points[j], &q = points[i];
+      if (p.y == q.y)
+        continue;
+      // half-open in y so shared vertices count once
+      if ((y >= p.y && y < q.y) || (y >= q.y && y < p.y))
+        xs.push_back(p.x + double(y - p.y) * double(q.x - p.x) / double(q.y - p.y));
+    }
+    std::sort(xs.begin(), xs.end());
+    for (size_t i = 0; i + 1 < xs.size(); i += 2)
+      span(int(ceil(xs[i])), int(ceil(xs[i + 1])) - 1, y, color);
+  }
+}
+
+void DrawList::line(Pixels::Coord a, Pixels::Coord b, const Pixel32 &color) {
+  Primitive prim { Line, color };
+  prim.first = int(points.size());
+  prim.count = 2;
+  prim.top = std::min(a.y, b.y);
+  prim.bottom = std::max(a.y, b.y);
+  points.push_back(a);
+  points.push_back(b);
+  prims.push_back(prim);
+}
+
+void DrawList::rect(const Rect &r, const Pixel32 &color) {
+  Primitive prim { Rectangle, color };
+  prim.first = int(points.size());
+  prim.count = 2;
+  prim.top = r.y;
+  prim.bottom = r.y + r.h - 1;
+  points.emplace_back(r.x, r.y);
+  points.emplace_back(r.w, r.h);
+  prims.push_back(prim);
+}
+
+void DrawList::fillRect(const Rect &r, const Pixel32 &color) {
+  rect(r, color);
+  prims.back().kind = FilledRectangle;
+}
+
+void DrawList::circle(Pixels::Coord c, int radius, const Pixel32 &color) {
+  Primitive prim { Circle, color };
+  prim.first = int(points.size());
+  prim.count = 1;
+  prim.radius = radius;
+  prim.top = c.y - radius;
+  prim.bottom = c.y + radius;
+  points.push_back(c);
+  prims.push_back(prim);
+}
+
+void DrawList::fillCircle(Pixels::Coord c, int radius, const Pixel32 &color) {
+  circle(c, radius, color);
+  prims.back().kind = FilledCircle;
+}
+
+void DrawList::triangle(Pixels::Coord a, Pixels::Coord b, Pixels::Coord c, const Pixel32 &color) {
+  Pixels::Coord pts[3] = { a, b, c };
+  polygon(pts, 3, color);
+}
+
+void DrawList::polygon(const Pixels::Coord *pts, int count, const Pixel32 &color) {
+  if (count < 3)
+    return;
+  Primitive prim { Polygon, color };
+  prim.first = int(points.size());
+  prim.count = count;
+  prim.top = prim.bottom = pts[0].y;
+  for (int i = 0; i < count; i++) {
+    prim.top = std::min(prim.top, pts[i].y);
+    prim.bottom = std::max(prim.bottom, pts[i].y);
+    points.push_back(pts[i]);
+  }
+  prims.push_back(prim);
+}
+
+void DrawList::draw(Canvas &canvas, const Primitive &prim) {
+  const Pixels::Coord *pts = &points[prim.first];
+  switch (prim.kind) {
+    case Line:
+      canvas.line(pts[0], pts[1], prim.color);
+      break;
+    case Rectangle:
+      canvas.rect(Rect(pts[0].x, pts[0].y, pts[1].x, pts[1].y), prim.color);
+      break;
+    case FilledRectangle:
+      canvas.fillRect(Rect(pts[0].x, pts[0].y, pts[1].x, pts[1].y), prim.color);
+      break;
+    case Circle:
+      canvas.circle(pts[0], prim.radius, prim.color);
+      break;
+    case FilledCircle:
+      canvas.fillCircle(pts[0], prim.radius, prim.color);
+      break;
+    case Polygon:
+      canvas.polygon(pts, prim.count, prim.color);
+      break;
+  }
+}
+
+void DrawList::flush(Pixels &target, Jobs &jobs, int tileH) {
+  if (!target.hasData() || prims.empty()) {
+    clear();
+    return;
+  }
+  tileH = std::max(tileH, 1);
+  int numTiles = (target.h + tileH - 1) / tileH;
+  if (int(bins.size()) < numTiles)
+    bins.resize(numTiles);
+  for (int t = 0; t < numTiles; t++)
+    bins[t].clear();
+
+  for (int i = 0; i < int(prims.size()); i++) {
+    const Primitive &prim = prims[i];
+    if (prim.bottom < 0 || prim.top >= target.h)
+      continue;
+    int t0 = std::max(prim.top, 0) / tileH;
+    int t1 = std::min(prim.bottom, target.h - 1) / tileH;
+    for (int t = t0; t <= t1; t++)
+      bins[t].push_back(i);
+  }
+
+  jobs.parallelFor(numTiles, 1, [&](int begin, int end) {
+    for (int t = begin; t < end; t++) {
+      Canvas canvas(target, Rect(0, t * tileH, target.w, tileH));
+      for (int i : bins[t])
+        draw(canvas, prims[i]);
+    }
+  });
+  clear();
+}
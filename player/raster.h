@@ -0,0 +1,96 @@
+#pragma once
+
+#include "mysdl2.h"
+
+#include <vector>
+
+namespace sdl2 {
+
+struct Jobs;
+
+// Primitive rasterizer over a Pixels target. Every primitive is clipped
+// against 'clip' once up front, after which pixels are written without
+// per-pixel bounds checks. Coordinates are pixel centres; filled shapes
+// cover the pixels whose centres fall inside them (left/top edges inclusive).
+struct Canvas {
+  typedef Pixels::Coord Coord;
+
+  Pixels pixels;
+  Rect clip;  // inclusive x/y, exclusive x + w / y + h
+
+  Canvas(const Pixels &pixels);
+  Canvas(const Pixels &pixels, const Rect &clip);
+
+  void line(Coord a, Coord b, const Pixel32 &color);
+  void rect(const Rect &r, const Pixel32 &color);
+  void fillRect(const Rect &r, const Pixel32 &color);
+  void circle(Coord c, int radius, const Pixel32 &color);
+  void fillCircle(Coord c, int radius, const Pixel32 &color);
+  void triangle(Coord a, Coord b, Coord c, const Pixel32 &color);
+  void polygon(const Coord *points, int count, const Pixel32 &color);  // even-odd fill
+
+  void span(int x0, int x1, int y, const Pixel32 &color);  // [x0, x1], clipped
+  bool drawable() const {  // only 24 and 32 bpp targets are written
+    return pixels.hasData() && (pixels.bpp == 24 || pixels.bpp == 32);
+  }
+  bool inside(int x, int y) const {
+    return x >= clip.x && x < clip.x + clip.w && y >= clip.y && y < clip.y + clip.h;
+  }
+  Uint8* at(int x, int y) {
+    return &pixels.data[(pixels.inverted ? pixels.h - 1 - y : y) * pixels.p + x * (pixels.bpp / 8)];
+  }
+  void put(Uint8 *pixel, const Pixel32 &color) {
+    if (pixels.bpp == 32)
+      *(Pixel32*) pixel = color;
+    else {
+      pixel[0] = color.b;
+      pixel[1] = color.g;
+      pixel[2] = color.r;
+    }
+  }
+};
+
+// Records primitives and draws them in one go. flush() bins primitives by
+// bounding box into horizontal tiles and fills the tiles in parallel, each
+// one clipped to its own rows; submission order is kept within a tile.
+struct DrawList {
+  enum Kind {
+    Line,
+    Rectangle,
+    FilledRectangle,
+    Circle,
+    FilledCircle,
+    Polygon
+  };
+  struct Primitive {
+    Kind kind;
+    Pixel32 color;
+    int first = 0, count = 0;  // into 'points'
+    int radius = 0;
+    int top = 0, bottom = 0;  // bounding rows, inclusive
+  };
+
+  std::vector<Primitive> prims;
+  std::vector<Pixels::Coord> points;
+  std::vector<std::vector<int>> bins;
+
+  void line(Pixels::Coord a, Pixels::Coord b, const Pixel32 &color);
+  void rect(const Rect &r, const Pixel32 &color);
+  void fillRect(const Rect &r, const Pixel32 &color);
+  void circle(Pixels::Coord c, int radius, const Pixel32 &color);
+  void fillCircle(Pixels::Coord c, int radius, const Pixel32 &color);
+  void triangle(Pixels::Coord a, Pixels::Coord b, Pixels::Coord c, const Pixel32 &color);
+  void polygon(const Pixels::Coord *pts, int count, const Pixel32 &color);
+
+  void draw(Canvas &canvas, const Primitive &prim);
+  void flush(Pixels &target, Jobs &jobs, int tileH = 64);
+  void clear() {
+    prims.clear();
+    points.clear();
+  }
+  size_t size() const {
+    return prims.size();
+  }
+};
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+}
+
+#include "mysdl2.h"
+
+// What sws_scale() writes into 'dst': BGRA at 32 bpp and BGR at 24, the
+// byte order of Pixel32/Pixel24, AV_PIX_FMT_NONE for anything else.
+inline AVPixelFormat scaleFormat(const sdl2::Pixels &dst) {
+  if (!dst.hasData())
+    return AV_PIX_FMT_NONE;
+  return dst.bpp == 32 ? AV_PIX_FMT_BGRA :
+         dst.bpp == 24 ? AV_PIX_FMT_BGR24 : AV_PIX_FMT_NONE;
+}
+
+// One sws_scale() of 'src' into 'dst' through a 'ctx' already set up for
+// both, bottom-up when 'dst' is inverted.
+inline void scalePixels(SwsContext *ctx, const AVFrame *src,
+                        sdl2::Pixels &dst) {
+  uint8_t *data[4] = {
+      dst.inverted ? &dst.data[(dst.h - 1) * dst.p] : dst.data };
+  int linesize[4] = { dst.inverted ? -dst.p : dst.p };
+  sws_scale(ctx, src->data, src->linesize, 0, src->height, data, linesize);
+}
+
+// Same, with 'ctx' made or remade by sws_getCachedContext() as 'src' and
+// 'dst' call for; the caller frees it. Thumbnails and mosaic cells pass
+// SWS_AREA: they're big reductions, where area averaging holds up best.
+// False when 'dst' can't take it.
+inline bool scaleInto(SwsContext *&ctx, const AVFrame *src, sdl2::Pixels &dst,
+                      int flags) {
+  AVPixelFormat format = scaleFormat(dst);
+  if (format == AV_PIX_FMT_NONE)
+    return false;
+  ctx = sws_getCachedContext(ctx, src->width, src->height,
+                             AVPixelFormat(src->format), dst.w, dst.h, format,
+                             flags, nullptr, nullptr, nullptr);
+  if (!ctx)
+    return false;
+  scalePixels(ctx, src, dst);
+  return true;
+}
@@ -0,0 +1,383 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <algorithm>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/mem.h>
+}
+
+#include "mapped.h"
+
+// Input through a custom AVIOContext instead of FFmpeg's own protocol
+// handlers. A Source reads and seeks one stream of bytes; open() hangs it
+// under an AVFormatContext. reopen() gives an independent reader over the
+// same bytes, for the extra demuxers Player runs (keyframe scan, GOP cache).
+// The Source has to outlive every format context opened on it.
+//
+// A read blocked on the network gives up with AVERROR_EXIT once the format
+// context's interrupt callback fires, or for good after abort().
+struct Source {
+  int blockSize = 1 << 16;  // the AVIOContext's buffer
+  bool local = true;  // cheap to read through, worth scanning for keyframes
+  AVIOContext *avio = nullptr;
+  AVIOInterruptCB interrupt { nullptr, nullptr };  // set by open()
+  std::atomic<bool> aborted { false };
+
+  Source() = default;
+  Source(const Source&) = delete;
+  Source& operator =(const Source&) = delete;
+  virtual ~Source() {
+    if (avio) {
+      av_freep(&avio->buffer);
+      avio_context_free(&avio);
+    }
+  }
+
+  // bytes read, 0 at the end, an AVERROR on failure
+  virtual int read(uint8_t *buf, int size) = 0;
+  // new position, or an AVERROR
+  virtual int64_t seek(int64_t offset, int whence) = 0;
+  // total bytes, negative when unknown
+  virtual int64_t size() = 0;
+  virtual std::unique_ptr<Source> reopen() = 0;
+
+  // From any thread: reads blocked now or later fail with AVERROR_EXIT,
+  // before destroying a Source somebody may be reading from.
+  virtual void abort() {
+    aborted = true;
+  }
+
+  bool interrupted() {
+    return aborted
+        || (interrupt.callback && interrupt.callback(interrupt.opaque));
+  }
+
+  static int interruptPacket(void *opaque) {
+    return ((Source*) opaque)->interrupted() ? 1 : 0;
+  }
+
+  // Like avformat_open_input() with this as the input, '*fmtCtx' may be
+  // preallocated. The interrupt callback, 'interrupt' or else the one already
+  // on '*fmtCtx', goes on the context and on our own blocking reads. 'name'
+  // is only a hint for probing the format.
+  int open(AVFormatContext **fmtCtx, const char *name = "",
+           const AVIOInterruptCB *interrupt_ = nullptr) {
+    if (!avio) {
+      uint8_t *buffer = (uint8_t*) av_malloc(blockSize);
+      avio = avio_alloc_context(buffer, blockSize, 0, this, readPacket,
+                                nullptr, seekPacket);
+      if (!avio) {
+        av_free(buffer);
+        return AVERROR(ENOMEM);
+      }
+    }
+    if (!*fmtCtx)
+      *fmtCtx = avformat_alloc_context();
+    if (interrupt_)
+      (*fmtCtx)->interrupt_callback = *interrupt_;
+    interrupt = (*fmtCtx)->interrupt_callback;
+    (*fmtCtx)->pb = avio;
+    (*fmtCtx)->flags |= AVFMT_FLAG_CUSTOM_IO;
+    return avformat_open_input(fmtCtx, name, nullptr, nullptr);
+  }
+
+  static int readPacket(void *opaque, uint8_t *buf, int size) {
+    int n = ((Source*) opaque)->read(buf, size);
+    return n == 0 ? AVERROR_EOF : n;
+  }
+
+  static int64_t seekPacket(void *opaque, int64_t offset, int whence) {
+    Source *source = (Source*) opaque;
+    if (whence & AVSEEK_SIZE)
+      return source->size();
+    return source->seek(offset, whence & ~AVSEEK_FORCE);
+  }
+
+  // 'offset' from SEEK_SET/SEEK_CUR/SEEK_END as an absolute position
+  static int64_t target(int64_t offset, int whence, int64_t pos,
+                        int64_t length) {
+    switch (whence) {
+    case SEEK_SET:
+      return offset;
+    case SEEK_CUR:
+      return pos + offset;
+    case SEEK_END:
+      return length >= 0 ? length + offset : AVERROR(EINVAL);
+    }
+    return AVERROR(EINVAL);
+  }
+};
+
+// Bytes the caller keeps alive, read in place: one memcpy into FFmpeg's
+// buffer and no copy of our own.
+struct MemorySource : Source {
+  const uint8_t *data = nullptr;
+  int64_t length = 0, pos = 0;
+
+  MemorySource(const void *data_ = nullptr, size_t length_ = 0)
+      :
+      data((const uint8_t*) data_),
+      length(int64_t(length_)) {
+  }
+
+  int read(uint8_t *buf, int size) override {
+    int n = int(std::min<int64_t>(size, length - pos));
+    if (n <= 0)
+      return 0;
+    memcpy(buf, &data[pos], n);
+    pos += n;
+    return n;
+  }
+
+  int64_t seek(int64_t offset, int whence) override {
+    int64_t to = target(offset, whence, pos, length);
+    if (to < 0 || to > length)
+      return AVERROR(EINVAL);
+    return pos = to;
+  }
+
+  int64_t size() override {
+    return length;
+  }
+
+  std::unique_ptr<Source> reopen() override {
+    return std::make_unique<MemorySource>(data, size_t(length));
+  }
+};
+
+// A local file mapped read-only: no read() calls and no kernel copies,
+// seeking is free. Falls flat (valid() false) on anything mmap can't take.
+struct MappedSource : MemorySource {
+  std::string path;
+  sdl2::MappedFile file;
+
+  MappedSource(std::string_view path_)
+      :
+      path(path_) {
+    if (file.map(path.c_str())) {
+      file.sequential();
+      length = int64_t(file.size);
+    } else
+      printf("MappedSource failed to map '%s'\n", path.c_str());
+    data = (const uint8_t*) file.view;
+  }
+
+  bool valid() const {
+    return file.mapped();
+  }
+
+  // maps again rather than sharing, so either side can go first
+  std::unique_ptr<Source> reopen() override {
+    return std::make_unique<MappedSource>(path);
+  }
+};
+
+// FFmpeg's own protocols (file, http, ...) behind the Source interface,
+// mostly to put a ReadAheadSource in front of them. Connecting happens in the
+// constructor, where only abort() from another thread can break it off.
+struct ProtocolSource : Source {
+  std::string url;
+  AVIOContext *input = nullptr;
+
+  ProtocolSource(std::string_view url_)
+      :
+      url(url_) {
+    local = url.find("://") == std::string::npos
+        || url.compare(0, 7, "file://") == 0;
+    AVIOInterruptCB cb { interruptPacket, this };
+    if (avio_open2(&input, url.c_str(), AVIO_FLAG_READ, &cb, nullptr) < 0) {
+      printf("ProtocolSource failed to open '%s'\n", url.c_str());
+      input = nullptr;
+    }
+  }
+
+  ~ProtocolSource() {
+    if (input)
+      avio_closep(&input);
+  }
+
+  int read(uint8_t *buf, int size) override {
+    if (!input)
+      return AVERROR(EIO);
+    int n = avio_read(input, buf, size);
+    return n == AVERROR_EOF ? 0 : n;
+  }
+
+  int64_t seek(int64_t offset, int whence) override {
+    return input ? avio_seek(input, offset, whence) : AVERROR(EIO);
+  }
+
+  int64_t size() override {
+    return input ? avio_size(input) : -1;
+  }
+
+  std::unique_ptr<Source> reopen() override {
+    return std::make_unique<ProtocolSource>(url);
+  }
+};
+
+// Reads 'inner' ahead on a thread of its own, 'block' bytes at a time into a
+// ring of 'capacity' bytes, so the demuxer finds its data waiting instead of
+// blocking on the disk or the network. Seeks inside what's buffered just
+// skip forward, anywhere else they drop the buffer and restart the reader.
+struct ReadAheadSource : Source {
+  std::unique_ptr<Source> inner;
+  size_t capacity = 0, block = 0;
+  int64_t length = -1;
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<uint8_t> ring;
+  size_t head = 0, count = 0;  // 'count' bytes from 'pos' wait at 'head'
+  int64_t pos = 0;
+  bool eof = false, quit = false;
+  int error = 0;
+  uint64_t generation = 0;  // bumped by seeks, stale blocks are tossed
+  uint64_t waits = 0, refills = 0;
+  std::thread filler;
+
+  ReadAheadSource(std::unique_ptr<Source> inner_,
+                  size_t capacity_ = size_t(16) << 20,
+                  size_t block_ = size_t(1) << 20)
+      :
+      inner(std::move(inner_)),
+      capacity(std::max(capacity_, size_t(1) << 16)),
+      block(std::min(std::max(block_, size_t(4096)), capacity)) {
+    local = inner->local;
+    length = inner->size();
+    ring.resize(capacity);
+    filler = std::thread(&ReadAheadSource::fill, this);
+  }
+
+  ~ReadAheadSource() {
+    {
+      std::lock_guard<std::mutex> lg(mutex);
+      quit = true;
+    }
+    inner->abort();  // the filler may sit in a read that never returns
+    cv.notify_all();
+    filler.join();
+  }
+
+  void abort() override {
+    {
+      std::lock_guard<std::mutex> lg(mutex);
+      aborted = true;
+    }
+    inner->abort();
+    cv.notify_all();
+  }
+
+  void fill() {
+    std::vector<uint8_t> scratch(block);
+    int64_t innerPos = 0;
+    std::unique_lock<std::mutex> lk(mutex);
+    while (true) {
+      cv.wait(lk, [this]() {
+        return quit || (!eof && capacity - count >= block);
+      });
+      if (quit)
+        break;
+      uint64_t gen = generation;
+      int64_t at = pos + int64_t(count);
+      lk.unlock();
+      int n = 0;
+      if (length < 0 || at < length) {  // seeked past the end is just the end
+        if (at != innerPos) {
+          int64_t moved = inner->seek(at, SEEK_SET);
+          innerPos = moved;
+          if (moved < 0)
+            n = int(moved);
+        }
+        if (!n)
+          n = inner->read(scratch.data(), int(block));
+      }
+      if (n > 0)
+        innerPos += n;
+      lk.lock();
+      if (gen != generation)
+        continue;
+      if (n <= 0) {
+        eof = true;
+        error = n;
+      } else {
+        size_t tail = (head + count) % capacity;
+        size_t first = std::min(size_t(n), capacity - tail);
+        memcpy(&ring[tail], scratch.data(), first);
+        memcpy(&ring[0], &scratch[first], size_t(n) - first);
+        count += size_t(n);
+      }
+      cv.notify_all();
+    }
+  }
+
+  // The interrupt callback is polled while waiting, as FFmpeg's own
+  // protocols do; nothing wakes us when it starts firing.
+  int read(uint8_t *buf, int size) override {
+    std::unique_lock<std::mutex> lk(mutex);
+    if (!count && !eof)
+      waits++;
+    while (!count && !eof && !quit) {
+      if (interrupted())
+        return AVERROR_EXIT;
+      cv.wait_for(lk, std::chrono::milliseconds(10));
+    }
+    if (!count)
+      return quit ? AVERROR_EXIT : error;
+    size_t n = std::min(size_t(size), count);
+    size_t first = std::min(n, capacity - head);
+    memcpy(buf, &ring[head], first);
+    memcpy(&buf[first], &ring[0], n - first);
+    drop(n);
+    return int(n);
+  }
+
+  int64_t seek(int64_t offset, int whence) override {
+    std::lock_guard<std::mutex> lg(mutex);
+    int64_t to = target(offset, whence, pos, length);
+    if (to < 0)
+      return AVERROR(EINVAL);
+    if (to >= pos && to <= pos + int64_t(count))
+      drop(size_t(to - pos));
+    else {
+      pos = to;
+      head = count = 0;
+      eof = false;
+      error = 0;
+      generation++;
+      refills++;
+      cv.notify_all();
+    }
+    return to;
+  }
+
+  // expects the lock held
+  void drop(size_t n) {
+    head = (head + n) % capacity;
+    count -= n;
+    pos += int64_t(n);
+    cv.notify_all();  // room for the filler
+  }
+
+  int64_t size() override {
+    return length;
+  }
+
+  std::unique_ptr<Source> reopen() override {
+    return std::make_unique<ReadAheadSource>(inner->reopen(), capacity, block);
+  }
+};
@@ -0,0 +1,149 @@
+#include "surfaces.h"
+
+#include <x86intrin.h>
+
+using namespace sdl2;
+
+static inline Uint64 keyOf(int w, int h, int bpp) {
+  return (Uint64(Uint32(w)) << 32) | (Uint64(Uint32(h) & 0xffffff) << 8) | Uint64(bpp & 0xff);
+}
+
+static void freeSlot(SurfacePool::Slot &slot) {
+  if (slot.surf)
+    SDL_FreeSurface(slot.surf);  // preallocated, leaves the block alone
+  if (slot.block)
+    _mm_free(slot.block);
+  slot = SurfacePool::Slot();
+}
+
+PooledSurface::PooledSurface(PooledSurface &&rhs)
+    :
+    pool(rhs.pool),
+    block(rhs.block),
+    bytes(rhs.bytes),
+    surf(rhs.surf),
+    pixels(rhs.pixels) {
+  rhs.pool = nullptr;
+  rhs.block = nullptr;
+  rhs.surf = nullptr;
+  rhs.pixels = Pixels();
+}
+
+PooledSurface& PooledSurface::operator =(PooledSurface &&rhs) {
+  if (this != &rhs) {
+    release();
+    pool = rhs.pool;
+    block = rhs.block;
+    bytes = rhs.bytes;
+    surf = rhs.surf;
+    pixels = rhs.pixels;
+    rhs.pool = nullptr;
+    rhs.block = nullptr;
+    rhs.surf = nullptr;
+    rhs.pixels = Pixels();
+  }
+  return *this;
+}
+
+SDL_Surface* PooledSurface::surface() {
+  if (!surf && block) {
+    Uint32 amask = pixels.bpp == 32 ? 0xff000000 : 0;
+    surf = SDL_CreateRGBSurfaceFrom(block, pixels.w, pixels.h, pixels.bpp, pixels.p, 0x00ff0000, 0x0000ff00, 0x000000ff,
+                                    amask);
+  }
+  return surf;
+}
+
+void PooledSurface::release() {
+  if (!block)
+    return;
+  if (pool)
+    pool->giveBack(*this);
+  else {
+    SurfacePool::Slot slot { block, bytes, surf };
+    freeSlot(slot);
+  }
+  pool = nullptr;
+  block = nullptr;
+  surf = nullptr;
+  pixels = Pixels();
+}
+
+// never destroyed: buffers held by globals (an exchange, a mipmap) may be
+// handed back during static destruction, after a function-local static
+// pool would already be gone
+SurfacePool& SurfacePool::shared() {
+  static SurfacePool *pool = new SurfacePool();
+  return *pool;
+}
+
+PooledSurface SurfacePool::acquire(int w, int h, int bpp) {
+  PooledSurface surface;
+  if (w <= 0 || h <= 0 || (bpp != 24 && bpp != 32))
+    return surface;
+
+  Slot slot;
+  {
+    std::lock_guard<std::mutex> lg(mutex);
+    auto it = idle.find(keyOf(w, h, bpp));
+    if (it != idle.end() && !it->second.empty()) {
+      slot = it->second.back();
+      it->second.pop_back();
+      idleBytes -= slot.bytes;
+      hits++;
+    } else
+      misses++;
+  }
+  int pitch = pitchFor(w, bpp);
+  if (!slot.block) {
+    slot.bytes = size_t(pitch) * (h + 1);
+    slot.block = (Uint8*) _mm_malloc(slot.bytes, Align);
+    if (!slot.block)
+      return surface;
+  }
+
+  surface.pool = this;
+  surface.block = slot.block;
+  surface.bytes = slot.bytes;
+  surface.surf = slot.surf;
+  surface.pixels.data = slot.block;
+  surface.pixels.w = w;
+  surface.pixels.h = h;
+  surface.pixels.p = pitch;
+  surface.pixels.bpp = bpp;
+  return surface;
+}
+
+void SurfacePool::giveBack(PooledSurface &surface) {
+  Slot slot { surface.block, surface.bytes, surface.surf };
+  {
+    std::lock_guard<std::mutex> lg(mutex);
+    if (idleBytes + slot.bytes <= maxIdleBytes) {
+      idle[keyOf(surface.pixels.w, surface.pixels.h, surface.pixels.bpp)].push_back(slot);
+      idleBytes += slot.bytes;
+      return;
+    }
+  }
+  freeSlot(slot);
+}
+
+void SurfacePool::trim(size_t keepBytes) {
+  std::vector<Slot> doomed;
+  {
+    std::lock_guard<std::mutex> lg(mutex);
+    for (auto it = idle.begin(); it != idle.end() && idleBytes > keepBytes;) {
+      auto &slots = it->second;
+      while (!slots.empty() && idleBytes > keepBytes) {
+        idleBytes -= slots.back().bytes;
+        doomed.push_back(slots.back());
+        slots.pop_back();
+      }
+      if (slots.empty())
+        it = idle.erase(it);
+      else
+        ++it;
+    }
+  }
+  for (auto &slot : doomed)
+    freeSlot(slot);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "mysdl2.h"
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace sdl2 {
+
+struct SurfacePool;
+
+// Pixel buffer on loan from a SurfacePool, handed back on destruction. Rows
+// start on 64 byte boundaries and the pitch is padded to a multiple of 64,
+// with one spare row's worth of slack after the last row so vector code may
+// read or write whole registers past the visible width.
+struct PooledSurface {
+  SurfacePool *pool = nullptr;
+  Uint8 *block = nullptr;
+  size_t bytes = 0;
+  SDL_Surface *surf = nullptr;  // created on first surface() and kept with the block
+  Pixels pixels;
+
+  PooledSurface() = default;
+  PooledSurface(PooledSurface &&rhs);
+  PooledSurface& operator =(PooledSurface &&rhs);
+  PooledSurface(const PooledSurface&) = delete;
+  PooledSurface& operator =(const PooledSurface&) = delete;
+  ~PooledSurface() {
+    release();
+  }
+
+  // SDL_Surface over the same memory, for blits and saving
+  SDL_Surface* surface();
+  void release();
+  bool hasData() const {
+    return block != nullptr;
+  }
+};
+
+// Recycles 64 byte aligned pixel buffers by (w, h, bpp). Idle buffers are
+// capped at 'maxIdleBytes', beyond which returned buffers are freed. The pool
+// has to outlive every buffer it hands out.
+struct SurfacePool {
+  static constexpr int Align = 64;
+
+  struct Slot {
+    Uint8 *block = nullptr;
+    size_t bytes = 0;
+    SDL_Surface *surf = nullptr;
+  };
+
+  std::mutex mutex;
+  std::unordered_map<Uint64, std::vector<Slot>> idle;
+  size_t maxIdleBytes = 256u << 20;
+  size_t idleBytes = 0;
+  Uint64 hits = 0, misses = 0;
+
+  SurfacePool(size_t maxIdleBytes = 256u << 20)
+      :
+      maxIdleBytes(maxIdleBytes) {
+  }
+  SurfacePool(const SurfacePool&) = delete;
+  SurfacePool& operator =(const SurfacePool&) = delete;
+  ~SurfacePool() {
+    trim(0);
+  }
+
+  static SurfacePool& shared();
+  static int pitchFor(int w, int bpp) {
+    return (w * (bpp / 8) + Align - 1) / Align * Align;
+  }
+
+  PooledSurface acquire(int w, int h, int bpp);
+  void giveBack(PooledSurface &surface);
+  void trim(size_t keepBytes);  // frees idle buffers until at most keepBytes remain
+};
+
+}
@@ -5,6 +5,10 @@
 #include <algorithm>
 
 #include <mysdl2/mysdl2.h>
+#include <mysdl2/assets.h>
+#include <mysdl2/jobs.h>
+#include <mysdl2/raster.h>
+#include <mysdl2/loop.h>
 
 #include "water.h"
 
@@ -14,6 +18,8 @@ using namespace sdl2;
 #define DISP_H 512
 
 SDL sdl;
+std::unique_ptr<Assets> assets;  // made in main(), not during static init
+AssetHandle<MappedBitmap> dropBitmap;
 
 enum DrawType {
   Height,
@@ -24,6 +30,7 @@ enum DrawType {
 std::shared_ptr<Water> water = nullptr;
 Field<float> drop;
 DrawType drawType { Height };
+DrawList overlay;
 
 Pixel24 toPixel(float value) {
   value = std::clamp(value, 0.0f, 1.0f);
@@ -33,16 +40,17 @@ Pixel24 toPixel(float value) {
 
 void init() {
   water = std::make_shared<Water>(DISP_W, DISP_H, 1.0f);
-  Bitmap bitmap("drop.bmp");
+  MappedBitmap &bitmap = *dropBitmap.get();
   printf("water droplet size: %d x %d\n", bitmap.width(), bitmap.height());
-  bitmap.lock();
-  if (bitmap.pixels.data) {
+  if (bitmap.pixels.hasData() && bitmap.depth() == 24) {
     auto &pixels = bitmap.pixels;
     drop.init(pixels.w, pixels.h);
     for (int y = 0; y < drop.h; y++)
       for (int x = 0; x < drop.w; x++)
         drop(x, y) = float(pixels.get24(x, y)->r) / 255.0f;
   }
+  dropBitmap = AssetHandle<MappedBitmap>();
+  assets->purge();  // the preload ref too
 }
 
 void term() {
@@ -60,6 +68,20 @@ void term() {
   bitmap.unlock();
 }
 
+void drip(int xc, int yc) {
+  printf("drip...\n");
+  for (int y = 0; y < drop.h; y++)
+    for (int x = 0; x < drop.w; x++) {
+      int xo = xc - drop.w / 2 + x;
+      int yo = yc - drop.h / 2 + y;
+      (*water)(xo, yo) = drop.get(x, y) * 0.33f;
+      if ((*water)(xo, yo) > 1.0f)
+        (*water)(xo, yo) = 1.0f;
+      if ((*water)(xo, yo) < -1.0f)
+        (*water)(xo, yo) = -1.0f;
+    }
+}
+
 void step() {
   if (sdl.keyDown('1'))
     drawType = DrawType::Height;
@@ -68,98 +90,124 @@ void step() {
   if (sdl.keyDown('3'))
     drawType = DrawType::Gradient;
 
-  if (sdl.mouseKeyPress(0)) {
-    printf("drip...\n");
-    for (int y = 0; y < drop.h; y++)
-      for (int x = 0; x < drop.w; x++) {
-        int xo = sdl.mouseX - drop.w / 2 + x;
-        int yo = sdl.mouseY - drop.h / 2 + y;
-        (*water)(xo, yo) = drop.get(x, y) * 0.33f;
-        if ((*water)(xo, yo) > 1.0f)
-          (*water)(xo, yo) = 1.0f;
-        if ((*water)(xo, yo) < -1.0f)
-          (*water)(xo, yo) = -1.0f;
-      }
+  // every click since the last step, at the position it happened
+  for (int i = 0; i < sdl.numEvents; i++) {
+    const InputEvent &event = sdl.events[i];
+    if (event.type == InputEvent::MouseDown && event.code == 0)
+      drip(event.x, event.y);
   }
   water->step();
 }
 
+// one arrow per cell along the surface gradient, batched and rasterized
+// across the job pool
+void drawFlowArrows(Pixels &pixels) {
+  constexpr int cell = 16;
+  constexpr float scale = 200.0f, maxLen = cell * 0.75f, head = 4.0f;
+  Pixel32 color(255, 255, 255, 255);
+  for (int y = cell / 2; y < water->h; y += cell)
+    for (int x = cell / 2; x < water->w; x += cell) {
+      float gx = water->n_x(x, y), gy = water->n_y(x, y);
+      float len = sqrtf(gx * gx + gy * gy);
+      if (len * scale < 1.0f)
+        continue;
+      float dx = gx / len, dy = gy / len;
+      float l = std::min(len * scale, maxLen);
+      Pixels::Coord from(x, y), to(x + int(dx * l), y + int(dy * l));
+      overlay.line(from, to, color);
+      overlay.line(to, Pixels::Coord(to.x + int((-dx - dy) * head), to.y + int((dx - dy) * head)), color);
+      overlay.line(to, Pixels::Coord(to.x + int((-dx + dy) * head), to.y + int((-dx - dy) * head)), color);
+    }
+  overlay.flush(pixels, Jobs::shared());
+}
+
 void draw() {
 
   auto pixels = sdl.lock();
-  for (int y = 0; y < water->h; y++)
-    for (int x = 0; x < water->w; x++) {
-      Pixel24 pix;
-      if (drawType == DrawType::Height)
-        pix = toPixel((*water)(x, y));
-      else if (drawType == DrawType::Divergence) {
-        float v = water->n_xx(x, y) + water->n_yy(x, y);
-        pix = toPixel(v * 5.0f);
-      } else if (drawType == DrawType::Gradient) {
-        constexpr float subdue = 0.33f;
-        float b = std::clamp(water->n(x, y), 0.0f, 1.0f);
-        float r = std::clamp(water->n_x(x, y), -1.0f, 1.0f);
-        float g = std::clamp(water->n_y(x, y), -1.0f, 1.0f);
-
-        float len = sqrtf(r * r + g * g);
-        if (len > 0.0f) {
-          r /= len;
-          g /= len;
-          r *= subdue;
-          g *= subdue;
+  Jobs::shared().parallelRows(pixels, [](Pixels &band, int y0) {
+    int rows = std::min(band.h, water->h - y0);
+    for (int row = 0; row < rows; row++)
+      for (int x = 0; x < water->w; x++) {
+        int y = y0 + row;
+        Pixel24 pix;
+        if (drawType == DrawType::Height)
+          pix = toPixel((*water)(x, y));
+        else if (drawType == DrawType::Divergence) {
+          float v = water->n_xx(x, y) + water->n_yy(x, y);
+          pix = toPixel(v * 5.0f);
+        } else if (drawType == DrawType::Gradient) {
+          constexpr float subdue = 0.33f;
+          float b = std::clamp(water->n(x, y), 0.0f, 1.0f);
+          float r = std::clamp(water->n_x(x, y), -1.0f, 1.0f);
+          float g = std::clamp(water->n_y(x, y), -1.0f, 1.0f);
+
+          float len = sqrtf(r * r + g * g);
+          if (len > 0.0f) {
+            r /= len;
+            g /= len;
+            r *= subdue;
+            g *= subdue;
+          }
+          r = 0.5f + r * 0.5f;
+          g = 0.5f + g * 0.5f;
+          pix = Pixel24(r * 255.0f, g * 255.0f, b * 255.0f);
         }
-        r = 0.5f + r * 0.5f;
-        g = 0.5f + g * 0.5f;
-        pix = Pixel24(r * 255.0f, g * 255.0f, b * 255.0f);
+        band.plot(x, row, pix.r, pix.g, pix.b);
       }
-      pixels.plot(x, y, pix.r, pix.g, pix.b);
-    }
+  });
+
+  if (drawType == DrawType::Gradient)
+    drawFlowArrows(pixels);
+}
+
+// usage: wave_equation [--headless <frames>]
+// headless runs drip once in the centre, then steps and draws as fast as
+// possible with no window and prints the final frame hash
+int headless(int frames) {
+  if (!sdl.initOffscreen( DISP_W, DISP_H))
+    return 1;
+  init();
+  drip( DISP_W / 2, DISP_H / 2);
+
+  double invFreq = 1.0 / sdl.getPerfFreq();
+  Uint64 begin = sdl.getPerfCounter();
+  for (int i = 0; i < frames; i++) {
+    sdl.pump();
+    water->step();
+    draw();
+    sdl.swap();
+  }
+  double secs = (double) (sdl.getPerfCounter() - begin) * invFreq;
+  printf("%d frames in %f s (%f ms/frame)\n", frames, secs, frames ? secs * 1e3 / frames : 0.0);
+  printf("frame hash: %08x\n", sdl.frameHash());
+  sdl.takeScreenshot();
+  sdl.term();
+  return 0;
 }
 
 int main(int argc, char *args[]) {
   setbuf( stdout, NULL);
+  assets = std::make_unique<Assets>();
+  dropBitmap = assets->mapped("drop.bmp", Assets::High);  // loads while the window opens
+  if (argc > 2 && std::string_view(args[1]) == "--headless")
+    return headless(atoi(args[2]));
   if (!sdl.init( DISP_W, DISP_H, false))
     return 0;
 
-  setbuf( stdout, NULL);
-
-  double drawTimeInSecs = 0.0;
-  double stepTimeInSecs = 0.0;
-  Uint32 drawCount = 0.0;
-  Uint32 stepCount = 0.0;
-  double invFreq = 1.0 / sdl.getPerfFreq();
-
-  auto start = sdl.getTicks();
-  auto last = start;
   init();
-  while (true) {
-    auto now = sdl.getTicks();
-    auto elapsed = now - last;
-    if (elapsed >= 20) {
-      sdl.pump();
-      if (sdl.keyDown(SDLK_ESCAPE))
-        break;
-
-      Uint64 begin = sdl.getPerfCounter();
-      step();
-      stepCount++;
-      stepTimeInSecs += (double) (sdl.getPerfCounter() - begin) * invFreq;
-      last = (now / 20) * 20;
-    }
-
-    Uint64 begin = sdl.getPerfCounter();
+  Loop loop(50.0, 60.0);
+  loop.run([]() {
+    sdl.pump();
+    if (sdl.quit || sdl.keyDown(SDLK_ESCAPE))
+      return false;
+    step();
+    return true;
+  }, [](float alpha) {
     draw();
-    drawCount++;
     sdl.swap();
-    drawTimeInSecs += (double) (sdl.getPerfCounter() - begin) * invFreq;
-  }
+  });
   term();
-  if (stepCount)
-    printf("Average step time: %f ms\n",
-           (float) ((stepTimeInSecs * 1e3) / (double) drawCount));
-  if (drawCount)
-    printf("Average draw time: %f ms\n",
-           (float) ((drawTimeInSecs * 1e3) / (double) drawCount));
+  loop.report();
 
   sdl.term();
   printf("goodbye!\n");